@@ -33,6 +33,7 @@ Usage:
              --cert /path/server.crt --key /path/server.key \
              --port 8443 --output /tmp/dsid.json \
              [--timeout 300] [--quiesce 3] [--log-file /tmp/proxy.log]
+             [--upstream-ip 203.0.113.7] [--wait-for-real-dsid]
 """
 
 import argparse
@@ -409,6 +410,17 @@ def main():
     ap.add_argument("--log-file", default="",
                     help="Optional path to also write logs to (in addition "
                          "to stderr).")
+    ap.add_argument("--upstream-ip", default="",
+                    help="Forward to this address instead of resolving the "
+                         "hostname via DoH. For callers without the "
+                         "/etc/hosts override (the CEF auth-dialog's race "
+                         "mode), where the system resolver is right.")
+    ap.add_argument("--wait-for-real-dsid", action="store_true",
+                    help="Only start the quiesce countdown once a "
+                         "committable DSID was seen. A placeholder DSID "
+                         "early in the flow then does not end the capture "
+                         "while the user is still at the IdP, which matters "
+                         "when another client is routed through this proxy.")
     args = ap.parse_args()
 
     global _log_file
@@ -440,12 +452,15 @@ def main():
     sock.settimeout(1.0)
     log(f"Listening on 127.0.0.1:{args.port}")
 
-    log(f"Resolving {args.hostname} via DoH...")
-    try:
-        real_ip = resolve_via_doh(args.hostname)
-    except Exception as e:
-        log(f"DoH resolution failed: {e}")
-        sys.exit(1)
+    if args.upstream_ip:
+        real_ip = args.upstream_ip
+    else:
+        log(f"Resolving {args.hostname} via DoH...")
+        try:
+            real_ip = resolve_via_doh(args.hostname)
+        except Exception as e:
+            log(f"DoH resolution failed: {e}")
+            sys.exit(1)
     log(f"Real server IP: {real_ip}")
 
     log("Fetching real server certificate fingerprint...")
@@ -472,7 +487,9 @@ def main():
         # have been quiet for --quiesce. We quiesce on ANY candidate (not only
         # committable ones) so a flow that produced only a degenerate / early
         # placeholder DSID fails fast instead of waiting out the full timeout.
-        if state.any_dsid_seen():
+        # --wait-for-real-dsid trades that for not cutting off a slow login.
+        if state.any_dsid_seen() and (not args.wait_for_real_dsid or
+                                      state.latest_committable() is not None):
             quiet_for = state.seconds_since_last_dsid()
             if quiet_for >= args.quiesce:
                 log(f"DSID activity quiesced for {quiet_for:.1f}s ≥ "
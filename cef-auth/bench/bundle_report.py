@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+"""
+Install size and cold-start page-in of the full vs pruned CEF bundle.
+
+Sizes are always reported. With --binary, each bundle is also laid out the
+way `make install` puts it in lib/cef and the auth binary is run --runs times
+against mock_gateway.py with LD_LIBRARY_PATH pointing at that layout:
+
+    full              ${CEF_ROOT}/Release + Resources, no readahead.list
+    pruned            the staged pruned bundle without readahead.list
+    pruned-readahead  the staged pruned bundle as installed
+
+Before every run the layout's pages are dropped from the page cache
+(posix_fadvise DONTNEED, which only evicts clean unmapped pages, so nothing
+else may hold the files open). After the run mincore() tells how much of
+each file was read back in, which is the bundle's cold-start page-in. The
+time to DSID is printed next to it. Needs a display, like run_bench.py.
+
+Usage:
+    bundle_report.py --full $CEF_ROOT --pruned build/cef-pruned
+                     [--binary build/cef-pulse-auth] [--runs 5] [--json out.json]
+"""
+
+import argparse
+import ctypes
+import json
+import mmap
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, HERE)
+from run_bench import percentile  # noqa: E402
+
+PAGE_SIZE = os.sysconf("SC_PAGE_SIZE")
+libc = ctypes.CDLL(None, use_errno=True)
+
+
+def bundle_files(root):
+    """Relative path -> absolute path of every regular file under root."""
+    files = {}
+    for dirpath, _, names in os.walk(root):
+        for name in names:
+            path = os.path.join(dirpath, name)
+            if os.path.isfile(path) and not os.path.islink(path):
+                files[os.path.relpath(path, root)] = path
+    return files
+
+
+def full_bundle_files(cef_root):
+    """The full bundle as installed: Release and Resources merged."""
+    files = bundle_files(os.path.join(cef_root, "Resources"))
+    files.update(bundle_files(os.path.join(cef_root, "Release")))
+    return files
+
+
+def total_size(files):
+    return sum(os.path.getsize(p) for p in files.values())
+
+
+def lay_out(files, dest, readahead):
+    """Hardlink (or copy, across filesystems) files into an install-like dir."""
+    for rel, src in files.items():
+        if rel == "readahead.list" and not readahead:
+            continue
+        dst = os.path.join(dest, rel)
+        os.makedirs(os.path.dirname(dst), exist_ok=True)
+        try:
+            os.link(src, dst)
+        except OSError:
+            shutil.copy2(src, dst)
+    return bundle_files(dest)
+
+
+def evict(files):
+    for path in files.values():
+        try:
+            fd = os.open(path, os.O_RDONLY)
+        except OSError:
+            continue
+        try:
+            os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+        finally:
+            os.close(fd)
+
+
+def resident_bytes(path):
+    """Bytes of path currently in the page cache."""
+    size = os.path.getsize(path)
+    if size == 0:
+        return 0
+    with open(path, "rb") as f:
+        # A private mapping is writable for ctypes without faulting pages in
+        m = mmap.mmap(f.fileno(), size, access=mmap.ACCESS_COPY)
+    try:
+        pages = (size + PAGE_SIZE - 1) // PAGE_SIZE
+        vec = (ctypes.c_ubyte * pages)()
+        anchor = ctypes.c_char.from_buffer(m)
+        try:
+            if libc.mincore(ctypes.c_void_p(ctypes.addressof(anchor)), ctypes.c_size_t(size), vec) != 0:
+                raise OSError(ctypes.get_errno(), "mincore failed for " + path)
+        finally:
+            del anchor
+        return sum(1 for v in vec if v & 1) * PAGE_SIZE
+    finally:
+        m.close()
+
+
+def run_cold(binary, url, layout, files, timeout):
+    home = tempfile.mkdtemp(prefix="cef-bundle-")
+    try:
+        evict(files)
+        env = dict(os.environ, HOME=home)
+        env["LD_LIBRARY_PATH"] = layout + (":" + env["LD_LIBRARY_PATH"] if env.get("LD_LIBRARY_PATH") else "")
+        start = time.monotonic()
+        proc = subprocess.Popen([binary, "--url", url, "--timeout", str(timeout), "--mimic-pulse"],
+                                stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                                env=env, text=True, start_new_session=True)
+        time_to_dsid = None
+        for line in proc.stdout:
+            if line.startswith("DSID=") and time_to_dsid is None:
+                time_to_dsid = (time.monotonic() - start) * 1000
+        try:
+            proc.wait(timeout=timeout + 10)
+        except subprocess.TimeoutExpired:
+            proc.kill()
+            proc.wait()
+        paged = {rel: resident_bytes(path) for rel, path in files.items()}
+    finally:
+        shutil.rmtree(home, ignore_errors=True)
+    return {
+        "ok": proc.returncode == 0 and time_to_dsid is not None,
+        "time_to_dsid_ms": time_to_dsid,
+        "paged_in_bytes": sum(paged.values()),
+        # A RUNPATH/RPATH in the binary wins over LD_LIBRARY_PATH and would
+        # make it load some other libcef.so than the one under test
+        "libcef_loaded": paged.get("libcef.so", 0) > 0,
+    }
+
+
+def mb(value):
+    return "-" if value is None else "%.1f" % (value / 1048576.0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--full", required=True, help="CEF_ROOT of the full bundle")
+    parser.add_argument("--pruned", required=True, help="Staged pruned bundle (build/cef-pruned)")
+    parser.add_argument("--binary", help="Also measure cold-start page-in with this cef-pulse-auth")
+    parser.add_argument("--runs", type=int, default=5, help="Cold runs per bundle (default: 5)")
+    parser.add_argument("--timeout", type=int, default=60, help="Per-run auth timeout (default: 60)")
+    parser.add_argument("--gateway-port", type=int, default=18443)
+    parser.add_argument("--idp-port", type=int, default=18444)
+    parser.add_argument("--json", help="Also write the raw results here")
+    args = parser.parse_args()
+
+    full = full_bundle_files(args.full)
+    pruned = bundle_files(args.pruned)
+    if "libcef.so" not in pruned:
+        print("No pruned bundle at %s; build the cef-pruned-bundle target first" % args.pruned, file=sys.stderr)
+        return 1
+
+    report = {"size": {"full": {"files": len(full), "bytes": total_size(full)},
+                       "pruned": {"files": len(pruned), "bytes": total_size(pruned)}},
+              "runs": {}}
+    print("%-8s %6s %10s" % ("bundle", "files", "size MB"))
+    for name in ("full", "pruned"):
+        entry = report["size"][name]
+        print("%-8s %6d %10s" % (name, entry["files"], mb(entry["bytes"])))
+    missing = sorted(rel for rel in pruned if rel not in full and rel != "readahead.list")
+    if missing:
+        print("warning: pruned files not in the full bundle: %s" % ", ".join(missing), file=sys.stderr)
+
+    if not args.binary:
+        if args.json:
+            with open(args.json, "w") as f:
+                json.dump(report, f, indent=2)
+        return 0
+
+    mock = subprocess.Popen(
+        [sys.executable, os.path.join(HERE, "mock_gateway.py"),
+         "--gateway-port", str(args.gateway_port), "--idp-port", str(args.idp_port)],
+        stderr=subprocess.DEVNULL,
+    )
+    time.sleep(0.5)
+    url = "http://127.0.0.1:%d/saml" % args.gateway_port
+
+    workdir = tempfile.mkdtemp(prefix="cef-bundles-")
+    try:
+        for name, files, readahead in (("full", full, False),
+                                       ("pruned", pruned, False),
+                                       ("pruned-readahead", pruned, True)):
+            layout = os.path.join(workdir, name)
+            laid_out = lay_out(files, layout, readahead)
+            runs = []
+            for i in range(args.runs):
+                run = run_cold(args.binary, url, layout, laid_out, args.timeout)
+                runs.append(run)
+                print("%-16s run %2d: %s, %s MB paged in" % (
+                    name, i + 1,
+                    "%.0f ms" % run["time_to_dsid_ms"] if run["ok"] else "FAILED",
+                    mb(run["paged_in_bytes"])), file=sys.stderr)
+            if not any(r["libcef_loaded"] for r in runs):
+                print("warning: %s: libcef.so was never paged in from the layout; "
+                      "the binary's RUNPATH probably points at another copy" % name, file=sys.stderr)
+            report["runs"][name] = runs
+    finally:
+        mock.terminate()
+        mock.wait()
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    header = "%-16s %5s %12s %12s %10s %10s" % (
+        "bundle", "ok", "page-in p50", "page-in p95", "dsid p50", "dsid p95")
+    print()
+    print(header)
+    print("-" * len(header))
+    for name, runs in report["runs"].items():
+        ok = [r for r in runs if r["ok"]]
+        dsid = [r["time_to_dsid_ms"] for r in ok]
+        paged = [r["paged_in_bytes"] for r in runs]
+        print("%-16s %2d/%-2d %10sMB %10sMB %10s %10s" % (
+            name, len(ok), len(runs),
+            mb(percentile(paged, 50)), mb(percentile(paged, 95)),
+            "-" if not dsid else "%.0f" % percentile(dsid, 50),
+            "-" if not dsid else "%.0f" % percentile(dsid, 95)))
+    print("(times in ms)")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+
+    return 0 if all(r["ok"] for runs in report["runs"].values() for r in runs) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
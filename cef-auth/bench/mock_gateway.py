@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+Local mock of a Pulse gateway and a SAML IdP for benchmarking cef-pulse-auth.
+
+Serves two origins from one process so the gateway and the IdP are different
+hosts, as in production (the auth browser only trusts Set-Cookie: DSID from
+the --url host):
+
+    gateway  http://127.0.0.1:<gateway-port>
+    IdP      http://localhost:<idp-port>
+
+Flow (mirrors a Pulse SAML realm):
+
+  1. GET  gateway /saml          302 -> IdP /sso, sets the placeholder DSID=1
+  2. GET  IdP /sso               302 -> IdP /login (session check)
+  3. GET  IdP /login             HTML page with script/CSS assets and a form
+                                 that auto-submits the assertion after
+                                 --think-ms (stands in for the user / MFA)
+  4. POST gateway /saml/acs      sets the real 32-hex DSID, 302 -> /dana/home
+  5. GET  gateway /dana/home     landing page
+
+Every step can be slowed down with --latency-ms to approximate a remote
+gateway. No TLS: the auth browser's DSID detection works the same over HTTP.
+
+Usage:
+    mock_gateway.py [--gateway-port 18443] [--idp-port 18444]
+                    [--latency-ms 20] [--think-ms 200]
+"""
+
+import argparse
+import secrets
+import sys
+import threading
+import time
+
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+# Bulk for the IdP assets so cold vs warm cache runs differ measurably
+IDP_SCRIPT = ("/* mock IdP bundle */\n" + "var pad = '%s';\n" % ("x" * 1024)) * 384
+IDP_STYLE = ("body { font-family: sans-serif; }\n" + "/* %s */\n" % ("y" * 1024)) * 64
+
+
+class MockHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "MockPulse/1.0"
+
+    def log_message(self, fmt, *args):
+        if self.server.verbose:
+            sys.stderr.write("[%s] %s\n" % (self.server.role, fmt % args))
+
+    def _send(self, status, body=b"", headers=(), content_type="text/html"):
+        time.sleep(self.server.latency)
+        self.send_response(status)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        path = self.path.split("?", 1)[0]
+        if self.server.role == "gateway":
+            if path == "/saml":
+                self._send(302, headers=[
+                    ("Location", "%s/sso?SAMLRequest=mock" % self.server.idp_origin),
+                    ("Set-Cookie", "DSID=1; path=/"),
+                ])
+            elif path == "/dana/home":
+                self._send(200, b"<html><body>Welcome to the mock VPN</body></html>")
+            else:
+                self._send(404, b"not found")
+            return
+
+        if path == "/sso":
+            self._send(302, headers=[("Location", "/login")])
+        elif path == "/login":
+            page = """<html><head>
+<link rel="stylesheet" href="/assets/idp.css">
+<script src="/assets/idp.js"></script>
+</head><body>
+<form id="f" method="POST" action="%s/saml/acs">
+<input type="hidden" name="SAMLResponse" value="bW9jaw==">
+</form>
+<script>setTimeout(function () { document.getElementById('f').submit(); }, %d);</script>
+</body></html>""" % (self.server.gateway_origin, self.server.think_ms)
+            self._send(200, page.encode())
+        elif path == "/assets/idp.js":
+            self._send(200, IDP_SCRIPT.encode(), content_type="application/javascript",
+                       headers=[("Cache-Control", "public, max-age=86400")])
+        elif path == "/assets/idp.css":
+            self._send(200, IDP_STYLE.encode(), content_type="text/css",
+                       headers=[("Cache-Control", "public, max-age=86400")])
+        else:
+            self._send(404, b"not found")
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length") or 0)
+        self.rfile.read(length)
+        if self.server.role == "gateway" and self.path.startswith("/saml/acs"):
+            self._send(302, headers=[
+                ("Location", "/dana/home"),
+                ("Set-Cookie", "DSID=%s; path=/; HttpOnly" % secrets.token_hex(16)),
+            ])
+        else:
+            self._send(404, b"not found")
+
+
+def make_server(role, port, args):
+    server = ThreadingHTTPServer(("127.0.0.1", port), MockHandler)
+    server.daemon_threads = True
+    server.role = role
+    server.verbose = args.verbose
+    server.latency = args.latency_ms / 1000.0
+    server.think_ms = args.think_ms
+    server.gateway_origin = "http://127.0.0.1:%d" % args.gateway_port
+    server.idp_origin = "http://localhost:%d" % args.idp_port
+    return server
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--gateway-port", type=int, default=18443)
+    parser.add_argument("--idp-port", type=int, default=18444)
+    parser.add_argument("--latency-ms", type=int, default=20,
+                        help="Delay added to every response (default: 20)")
+    parser.add_argument("--think-ms", type=int, default=200,
+                        help="Delay before the IdP form auto-submits (default: 200)")
+    parser.add_argument("--verbose", action="store_true", help="Log every request")
+    args = parser.parse_args()
+
+    idp = make_server("idp", args.idp_port, args)
+    threading.Thread(target=idp.serve_forever, daemon=True).start()
+    gateway = make_server("gateway", args.gateway_port, args)
+    print("Mock gateway on http://127.0.0.1:%d/saml" % args.gateway_port, file=sys.stderr, flush=True)
+    try:
+        gateway.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
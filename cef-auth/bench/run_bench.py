@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+"""
+Time-to-DSID benchmark for cef-pulse-auth against the local mock gateway.
+
+Starts mock_gateway.py, then drives the auth binary --runs times in each of
+four configurations:
+
+    cold-mimic    fresh profile per run, --mimic-pulse
+    cold-legacy   fresh profile per run, legacy Windows/Linux UA
+    warm-mimic    one profile primed by an untimed run, --mimic-pulse
+    warm-legacy   same, legacy UA
+
+The binary keeps its profile in $HOME/.cache/pulse-browser-auth, so each
+configuration gets its own temporary HOME. For every run the harness records:
+
+    time_to_dsid   spawn -> "DSID=" on stdout (what the auth-dialog waits for)
+    exit           spawn -> process exit
+    startup        cef_initialized phase from the binary's METRICS record
+    processes      Chromium child processes the binary saw (METRICS "processes")
+    peak_pss       peak summed PSS of the whole process tree, sampled at 20 Hz;
+                   unlike RSS it does not count pages shared between the
+                   Chromium processes once per process
+
+A run also fails if a DSID cookie is left in the profile's cookie DB once
+the binary has exited; "-- --persist-cookies localhost" turns on session
+cookie persistence, where that matters most.
+
+The harness prints p50/p95 per configuration. Needs a display (run under
+Xvfb or a desktop session); extra arguments after "--" are passed to the
+binary, e.g. to compare "-- --lean" against a baseline.
+
+Usage:
+    run_bench.py --binary build/cef-pulse-auth [--runs 10] [--json out.json] [-- --lean]
+"""
+
+import argparse
+import json
+import math
+import os
+import shutil
+import socket
+import sqlite3
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+CONFIGS = [
+    ("cold-mimic", False, True),
+    ("cold-legacy", False, False),
+    ("warm-mimic", True, True),
+    ("warm-legacy", True, False),
+]
+
+
+def tree_pss_kb(root_pid):
+    """Summed Pss of root_pid and all its descendants, from smaps_rollup."""
+    parents = {}
+    for name in os.listdir("/proc"):
+        if not name.isdigit():
+            continue
+        try:
+            with open("/proc/%s/stat" % name) as f:
+                stat = f.read()
+            parents[int(name)] = int(stat[stat.rindex(")") + 2:].split()[1])
+        except (OSError, ValueError, IndexError):
+            continue
+    pids = [root_pid]
+    for pid in pids:
+        pids.extend(child for child, parent in parents.items() if parent == pid)
+    total = 0
+    for pid in pids:
+        try:
+            with open("/proc/%d/smaps_rollup" % pid) as f:
+                for line in f:
+                    if line.startswith("Pss:"):
+                        total += int(line.split()[1])
+                        break
+        except OSError:
+            continue
+    return total
+
+
+def stored_dsid_cookies(home):
+    """DSID rows in the cookie DB(s) of the profile under home."""
+    count = 0
+    for root, _dirs, files in os.walk(os.path.join(home, ".cache", "pulse-browser-auth")):
+        if "Cookies" not in files:
+            continue
+        try:
+            db = sqlite3.connect("file:%s?mode=ro" % os.path.join(root, "Cookies"), uri=True)
+            try:
+                count += db.execute("SELECT COUNT(*) FROM cookies WHERE name = 'DSID'").fetchone()[0]
+            finally:
+                db.close()
+        except sqlite3.Error:
+            continue
+    return count
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile; None for an empty list."""
+    if not values:
+        return None
+    ordered = sorted(values)
+    rank = max(1, math.ceil(pct / 100.0 * len(ordered)))
+    return ordered[rank - 1]
+
+
+def run_once(binary, url, home, mimic, extra_args, timeout):
+    metrics_file = os.path.join(home, "metrics.jsonl")
+    if os.path.exists(metrics_file):
+        os.unlink(metrics_file)
+    cmd = [binary, "--url", url, "--timeout", str(timeout), "--metrics-file", metrics_file]
+    if mimic:
+        cmd.append("--mimic-pulse")
+    cmd.extend(extra_args)
+    env = dict(os.environ, HOME=home)
+
+    start = time.monotonic()
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                            env=env, text=True, start_new_session=True)
+    peak = [0]
+    done = threading.Event()
+
+    def sample():
+        while not done.is_set():
+            peak[0] = max(peak[0], tree_pss_kb(proc.pid))
+            done.wait(0.05)
+
+    sampler = threading.Thread(target=sample, daemon=True)
+    sampler.start()
+
+    time_to_dsid = None
+    for line in proc.stdout:
+        if line.startswith("DSID=") and time_to_dsid is None:
+            time_to_dsid = (time.monotonic() - start) * 1000
+    try:
+        proc.wait(timeout=timeout + 10)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+        proc.wait()
+    exit_ms = (time.monotonic() - start) * 1000
+    done.set()
+    sampler.join()
+
+    startup = processes = None
+    try:
+        with open(metrics_file) as f:
+            record = json.loads(f.readline())
+        startup = record.get("phases_ms", {}).get("cef_initialized")
+        processes = record.get("processes")
+    except (OSError, ValueError):
+        pass
+
+    stored_dsids = stored_dsid_cookies(home)
+    return {
+        "ok": proc.returncode == 0 and time_to_dsid is not None and stored_dsids == 0,
+        "stored_dsids": stored_dsids,
+        "time_to_dsid_ms": time_to_dsid,
+        "exit_ms": exit_ms,
+        "startup_ms": startup,
+        "processes": processes,
+        "peak_pss_kb": peak[0],
+    }
+
+
+def main():
+    argv = sys.argv[1:]
+    extra_args = []
+    if "--" in argv:
+        extra_args = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--binary", required=True, help="Path to cef-pulse-auth")
+    parser.add_argument("--runs", type=int, default=10, help="Timed runs per configuration (default: 10)")
+    parser.add_argument("--timeout", type=int, default=60, help="Per-run auth timeout (default: 60)")
+    parser.add_argument("--gateway-port", type=int, default=18443)
+    parser.add_argument("--idp-port", type=int, default=18444)
+    parser.add_argument("--latency-ms", type=int, default=20)
+    parser.add_argument("--json", help="Also write the raw results here")
+    args = parser.parse_args(argv)
+
+    mock = subprocess.Popen(
+        [sys.executable, os.path.join(HERE, "mock_gateway.py"),
+         "--gateway-port", str(args.gateway_port), "--idp-port", str(args.idp_port),
+         "--latency-ms", str(args.latency_ms)],
+        stderr=subprocess.DEVNULL,
+    )
+    ready = False
+    deadline = time.monotonic() + 15
+    while not ready and time.monotonic() < deadline and mock.poll() is None:
+        try:
+            for port in (args.gateway_port, args.idp_port):
+                socket.create_connection(("127.0.0.1", port), timeout=0.2).close()
+            ready = True
+        except OSError:
+            time.sleep(0.1)
+    if not ready:
+        print("mock gateway did not start listening on ports %d/%d"
+              % (args.gateway_port, args.idp_port), file=sys.stderr)
+        mock.terminate()
+        mock.wait()
+        return 1
+    url = "http://127.0.0.1:%d/saml" % args.gateway_port
+
+    results = {}
+    try:
+        for name, warm, mimic in CONFIGS:
+            home = tempfile.mkdtemp(prefix="cef-bench-")
+            try:
+                if warm:
+                    run_once(args.binary, url, home, mimic, extra_args, args.timeout)
+                runs = []
+                for i in range(args.runs):
+                    if not warm:
+                        shutil.rmtree(os.path.join(home, ".cache"), ignore_errors=True)
+                    run = run_once(args.binary, url, home, mimic, extra_args, args.timeout)
+                    runs.append(run)
+                    if run["ok"]:
+                        outcome = "%.0f ms" % run["time_to_dsid_ms"]
+                    elif run["stored_dsids"]:
+                        outcome = "FAILED (DSID left in the cookie DB)"
+                    else:
+                        outcome = "FAILED"
+                    print("%-12s run %2d: %s" % (name, i + 1, outcome), file=sys.stderr)
+                results[name] = runs
+            finally:
+                shutil.rmtree(home, ignore_errors=True)
+    finally:
+        mock.terminate()
+        mock.wait()
+
+    header = "%-12s %5s %10s %10s %10s %10s %10s %10s %6s" % (
+        "config", "ok", "dsid p50", "dsid p95", "exit p50", "start p50", "start p95", "pss p95", "procs")
+    print(header)
+    print("-" * len(header))
+    for name, runs in results.items():
+        ok = [r for r in runs if r["ok"]]
+
+        def pct(key, p, scale=1.0):
+            value = percentile([r[key] for r in ok if r[key] is not None], p)
+            return "-" if value is None else "%.0f" % (value / scale)
+
+        print("%-12s %2d/%-2d %10s %10s %10s %10s %10s %8sMB %6s" % (
+            name, len(ok), len(runs),
+            pct("time_to_dsid_ms", 50), pct("time_to_dsid_ms", 95),
+            pct("exit_ms", 50), pct("startup_ms", 50), pct("startup_ms", 95),
+            pct("peak_pss_kb", 95, 1024), pct("processes", 50)))
+    print("(times in ms)")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"extra_args": extra_args, "results": results}, f, indent=2)
+
+    return 0 if all(r["ok"] for runs in results.values() for r in runs) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -42,6 +42,8 @@
   vulkan-loader,
   pcsclite,
   libfido2,
+  # Install only the CEF files the auth binary loads (see CMakeLists.txt)
+  prunedBundle ? false,
 }:
 
 stdenv.mkDerivation {
@@ -101,7 +103,7 @@ stdenv.mkDerivation {
 
   cmakeFlags = [
     "-DCEF_ROOT=${cef-binary}"
-  ];
+  ] ++ lib.optional prunedBundle "-DCEF_PRUNED_BUNDLE=ON";
 
   postInstall = ''
     # Rename binary
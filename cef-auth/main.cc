@@ -1,31 +1,405 @@
 // Minimal CEF application for Pulse VPN SSO authentication
-// Navigates to VPN URL, waits for DSID cookie, outputs it and exits
+// Navigates to VPN URL, waits for DSID cookie, outputs it and exits. The
+// result is written as soon as the DSID is committed; browser close and
+// CefShutdown follow after it.
+//
+// The DSID is detected from the gateway's Set-Cookie response headers via a
+// CefCookieAccessFilter (IO thread), with a cookie-store scan on main-frame
+// load end as a fallback. There is no periodic polling; a single delayed task
+// enforces the timeout. Every DSID seen is recorded as a candidate; the latest
+// plausible one is committed once no new DSID has arrived for the quiesce
+// window (same rules as browser-auth/proxy.py).
+//
+// --url may be repeated: the first gateway's browser signs in; the others
+// open in the shared request context once its IdP round-trip has set the IdP
+// session cookies, so they complete without a second login. One DSID line
+// each.
+//
+// --revalidate <dsid> first checks with a single request whether a previous
+// DSID is still a live session, and runs the browser flow only if it isn't.
+//
+// With --silent-budget the flow first runs in a hidden windowless browser and
+// only maps the real window if no DSID arrives within the budget.
+//
+// Optional --block-rules cancel analytics, fonts, marketing images etc. on
+// the IdP pages before they reach the network.
+//
+// The on-disk cache is size-capped by Chromium; see g_cache_size_mb.
+//
+// The GPU/rendering command-line profile is picked per machine and cached;
+// see SelectGpuProfile().
+//
+// Per-phase timings of each auth run are emitted as one JSON record, on
+// stderr ("METRICS {...}") or appended to --metrics-file.
+//
+// With --daemon the process keeps its initialized CEF context alive and serves
+// auth requests over a UNIX socket, one at a time, so reconnects skip the CEF
+// cold start (subprocess spawn, GPU/renderer startup, extension loading).
 
 #include <iostream>
 #include <string>
 #include <cstring>
 #include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <atomic>
+#include <cerrno>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "include/cef_app.h"
 #include "include/cef_browser.h"
 #include "include/cef_client.h"
 #include "include/cef_command_line.h"
 #include "include/cef_cookie.h"
+#include "include/cef_display_handler.h"
+#include "include/cef_navigation_entry.h"
+#include "include/cef_render_handler.h"
+#include "include/cef_request_context.h"
 #include "include/cef_request_handler.h"
 #include "include/cef_resource_request_handler.h"
+#include "include/cef_ssl_status.h"
 #include "include/cef_task.h"
+#include "include/cef_trace.h"
+#include "include/cef_urlrequest.h"
+#include "include/cef_values.h"
+#include "include/cef_x509_certificate.h"
 #include "include/internal/cef_types.h"
 #include "include/wrapper/cef_helpers.h"
 
 // Global state
-std::string g_vpn_url;
-std::string g_dsid_cookie;
 std::string g_extension_path;
-bool g_found_cookie = false;
-bool g_should_close = false;
-int g_timeout_seconds = 300;
-std::chrono::steady_clock::time_point g_start_time;
-CefRefPtr<CefBrowser> g_browser;
+int g_timeout_seconds = 300;  // --timeout; a daemon AUTH request may pass its own
+
+// DSID candidate selection. Pulse sets a placeholder DSID ("DSID=1") during
+// the early SAML redirect and the real session DSID after the IdP posts the
+// assertion back; it also clears the cookie with "DSID=DELETED". Accepting the
+// first DSID seen would hand openconnect an unusable cookie, so every value is
+// recorded and the latest committable one wins once none newer has arrived for
+// g_quiesce_seconds. Placeholders never arm the window - the user may still be
+// in the middle of an interactive IdP login.
+struct DSIDCandidate {
+    std::string value;
+    int status;           // HTTP status of the response that set it (0 = cookie store)
+    std::string source;   // "set-cookie" or "cookie-store"
+    int64_t elapsed_ms;   // Since the session start
+    bool committable;
+};
+double g_quiesce_seconds = 1.0;
+size_t g_min_dsid_len = 16;  // A real session DSID is a ~32-char hex token
+
+// Gateways being authenticated, one per --url (a single one in daemon
+// sessions). Each gets its own browser in the shared global request context,
+// so the IdP session cookies left by the first login are reused by the other
+// windows, which then finish without user input, in parallel. UI thread only;
+// the session keeps a copy of the hosts for the IO thread.
+struct GatewayAuth {
+    std::string url;
+    std::string host;               // Matched against Set-Cookie responses
+    CefRefPtr<CefBrowser> browser;
+    bool creating = false;          // CreateBrowser issued, OnAfterCreated pending
+    bool silent = false;            // Still in the hidden silent-auth browser
+    std::vector<DSIDCandidate> candidates;
+    int generation = 0;             // Bumped per committable candidate; re-arms the quiesce window
+    bool found = false;
+    std::string dsid;
+    std::string gwcert;             // "sha256:<hex>" of the DER cert, as proxy.py reports it
+    std::string gwpin;              // "pin-sha256:<base64>" SPKI pin for openconnect --servercert
+    std::string committed_url;      // Last main-frame URL that started loading; renderer-crash reload target
+    int renderer_crashes = 0;
+    std::string entry_url;          // Cached realm SSO entry browsers start at; empty = url
+    bool entry_pending = false;     // Started at entry_url, not on the way to the IdP yet
+    std::string gateway_nav_url;    // Last main-frame navigation on the gateway before the IdP
+    std::string sso_entry_url;      // gateway_nav_url once the flow left for the IdP
+    bool credential_form_seen = false;  // An IdP page had a password field
+    std::vector<std::pair<std::string, int64_t>> phase_marks;  // This gateway's flow, see MarkPhase
+    std::vector<std::string> navigated_hosts;     // Main-frame hosts, saved for the next run
+};
+std::vector<std::string> g_gateway_urls;   // --url values, in order
+
+// A renderer that dies mid-flow (WebAuthn dialogs, misbehaving extensions)
+// costs a reload of the last committed URL in the same browser: cookies, the
+// IdP session and the timeout budget carry over. Past this many crashes per
+// gateway the run fails instead of looping.
+int g_max_renderer_reloads = 3;
+
+// Per-phase timing. Each phase records the first time it is reached, in ms
+// since the session start; the set is written as one JSON record when the run ends
+// so slow logins can be attributed to CEF startup, the gateway, the IdP, or
+// the post-login DSID hand-off.
+//   cef_initialized     CEF context ready (cold start only)
+//   gateway_load_start  first main-frame load of the gateway
+//   idp_redirect        first main-frame navigation away from the gateway
+//   ua_switch           legacy mode: switched from the Windows to the Linux UA
+//   saml_post           main-frame POST back to the gateway after the IdP
+//   dsid_first_seen     first DSID candidate (placeholders included)
+//   dsid_committed      DSID accepted after the quiesce window
+// cef_initialized (and revalidated) belong to the session, the others to the
+// gateway whose flow reached them. METRICS reports the first gateway's in
+// phases_ms and any others under gateway_phases_ms; --json gives each
+// gateway its own.
+//   silent_escalation   silent budget spent, visible window shown
+//   entry_fallback      cached SSO entry URL failed, gateway URL loaded instead
+std::string g_metrics_file;
+bool g_json_output = false;  // --json: result as JSON lines (proxy.py's format) instead of DSID=
+
+// --revalidate: check a previous DSID with one request before the browser
+// flow, in the same process, so a dead DSID costs one round-trip and not a
+// second CEF start. Pulse serves the portal home page, with its sign-out
+// link, for a live session. An expired one is sent to the sign-in page,
+// either by a redirect or by a 200 page that forwards to welcome.cgi, so a
+// 200 alone proves nothing.
+std::string g_revalidate_dsid;
+const char* kRevalidatePath = "/dana/home/index.cgi";
+const char* kRevalidateLiveMarker = "logout.cgi";
+const char* kRevalidateSignInMarker = "welcome.cgi";
+const size_t kRevalidateMaxBody = 256 * 1024;  // The home page is well under this
+const int kRevalidateTimeoutMs = 10000;
+
+// Resource blocking (--block-rules <file>). One rule per line, first match wins,
+// unmatched requests are allowed:
+//   deny  host=*.google-analytics.com
+//   deny  type=font,media
+//   allow host=login.okta.com path=/api/*
+//   deny  host=*.okta.com type=image
+// host/path are fnmatch globs (path excludes the query string); type is a
+// comma-separated list of resource types (see kResourceTypeNames). Main-frame
+// navigations and requests to the gateway itself are never blocked.
+// Rules are immutable after startup and read on the IO thread.
+struct BlockRule {
+    bool allow;
+    std::string host;
+    std::string path;
+    std::vector<int> types;  // cef_resource_type_t values; empty = any
+};
+std::vector<BlockRule> g_block_rules;
+std::string g_block_rules_file;
+
+// Request waterfall (--waterfall / --waterfall-file <path>): one entry per
+// request the auth browser makes, in a ring allocated with the session. Only
+// the IO thread touches it, so it needs no locking: the IO thread fills it,
+// finds a request's in-flight entry through a map keyed by the CefRequest
+// identifier, and serializes it when the metrics are emitted (requests may
+// still be in flight then). The JSON line is appended to the file on the file
+// thread, and older runs are
+// rotated to <file>.1 past kWaterfallFileMaxBytes. There is no "cached"
+// column: neither CefResponse nor the load-complete callback says whether a
+// response came from the HTTP cache, and the IdP-side slowness this is for
+// shows in the timings anyway.
+const size_t kWaterfallEntries = 1024;
+const int64_t kWaterfallFileMaxBytes = 4 << 20;
+struct WaterfallEntry {
+    int state = 0;              // 0 unused, 1 in flight, 2 complete
+    uint64_t id = 0;            // CefRequest identifier, kept across redirects
+    int type = 0;
+    int status = 0;
+    bool failed = false;
+    int64_t bytes = 0;
+    int64_t start_ms = 0;       // All since the session start
+    int64_t response_ms = -1;
+    int64_t end_ms = -1;
+    char host[64] = {};
+    char path[128] = {};
+};
+std::string g_waterfall_file;
+
+// --trace-file progress of a session
+enum TraceState { TRACE_OFF, TRACE_RUNNING, TRACE_WRITING, TRACE_DONE };
+
+// One authentication run: the whole process for a one-shot run, one AUTH
+// request in daemon mode. Nothing looks the session up globally: main()
+// owns the one-shot session and hands it to AuthApp, the daemon's listener
+// creates one per AUTH request, and every client, resource handler and task
+// keeps a reference to the session it was created for. Once a daemon
+// session has published its result it is marked ended, so a callback that
+// arrives late is dropped. Fields below "UI thread" are confined to it; the
+// IO thread only reads what is fixed at construction and the atomics,
+// through its own handler's reference, so the per-request path takes no
+// lock.
+//
+// What stays global is process-wide on purpose, shared by every AUTH a
+// daemon serves: the rendering profile and the evidence for its verdict
+// (g_gpu_*, g_frame_marker), since the profile is a command-line choice the
+// whole process runs with and confirmed or failed once, at the first frame
+// or at exit; g_extension_loaded, fixed before CefInitialize; g_peak_rss_kb,
+// the peak since the process started, which is what METRICS reports; and the daemon's one-AUTH-at-a-time bookkeeping
+// (g_session_active, g_daemon_requests), which BeginSessionTask and
+// EndDaemonSession set for every request.
+struct AuthSession : std::enable_shared_from_this<AuthSession> {
+    AuthSession(const std::vector<std::string>& urls, int timeout_seconds);
+
+    const std::chrono::steady_clock::time_point start_time;
+    const std::chrono::steady_clock::time_point deadline;
+    const std::vector<std::string> hosts;  // Gateway hosts, in --url order (any thread)
+
+    // UI thread
+    std::vector<GatewayAuth> gateways;
+    bool found_cookie = false;  // Every gateway has its DSID
+    bool should_close = false;
+    std::string close_reason;
+    std::vector<std::pair<std::string, int64_t>> phase_marks;  // Session-wide: cef_initialized, revalidated
+    bool followers_started = false;  // Gateways after the first have been opened
+    int navigation_count = 0;  // Main-frame navigations, redirects included
+    int redirect_count = 0;
+    std::atomic<int> process_count{0};  // Max browser process descendants seen, by ProcessSampleTask
+    std::atomic<bool> sampling{true};   // Cleared once the result is out; stops ProcessSampleTask
+    int dsid_deletes_pending = 0;  // Accepted DSIDs not yet gone from the cookie store
+    bool ended = false;        // Daemon: result published, late callbacks are dropped
+    std::string daemon_reply;  // Daemon: the client's reply line, guarded by g_result_mutex
+    CefRefPtr<CefURLRequest> revalidate_request;  // --revalidate, in flight
+    std::string revalidate_body;                  // Its response, up to kRevalidateMaxBody
+    TraceState trace_state = TRACE_OFF;
+    bool quit_pending = false;  // The message loop waits for the trace or a cookie delete
+    // Result sink: stdout of a one-shot run. Pointed at /dev/null once the
+    // result is written, so nothing else reaches the caller's pipe.
+    std::ostream* result_out = &std::cout;
+    int result_fd = STDOUT_FILENO;
+    bool result_emitted = false;
+
+    // IO thread writes, read once the run is over. Indexed by resource type;
+    // cancelled requests have no size, so bytes saved are estimated from the
+    // mean size of loaded requests of the same type.
+    std::atomic<int64_t> blocked_count[RT_NUM_VALUES] = {};
+    std::atomic<int64_t> loaded_count[RT_NUM_VALUES] = {};
+    std::atomic<int64_t> loaded_bytes[RT_NUM_VALUES] = {};
+    // IO thread only, see WaterfallEntry
+    std::vector<WaterfallEntry> waterfall;  // Empty unless enabled
+    uint64_t waterfall_next = 0;            // Requests recorded
+    std::unordered_map<uint64_t, uint64_t> waterfall_open;  // Request id -> ring index
+
+    int64_t ElapsedMs() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_time).count();
+    }
+    bool IsGatewayHost(const std::string& host) const {
+        return std::find(hosts.begin(), hosts.end(), host) != hosts.end();
+    }
+    // Index of the gateway with this host, or -1
+    int GatewayForHost(const std::string& host) const {
+        auto it = std::find(hosts.begin(), hosts.end(), host);
+        return it == hosts.end() ? -1 : static_cast<int>(it - hosts.begin());
+    }
+};
+
+// Managed cache. The profile in ~/.cache/pulse-browser-auth used to grow
+// without bound. Chromium caps the HTTP cache at --cache-size-mb
+// (disk-cache-size) and evicts least recently used entries itself, keeping
+// its index in step; the IdP bundles are read on every login, so they are
+// the last to go. Nothing deletes cache files behind its back, which would
+// leave the index stale and make Chromium rebuild it on the next start.
+// 0 MB leaves the cache size to Chromium.
+int g_cache_size_mb = 64;
+std::string g_cache_path;
+struct CacheStats {
+    int64_t entries = 0;
+    int64_t bytes = 0;
+};
+CacheStats g_cache_at_start;
+
+// Rendering profile. The full GPU set (Vulkan, OOP raster, zero-copy, no
+// software fallback) is fastest where it works, but on some iGPU and
+// NVIDIA/Wayland setups it means slow GPU process startup, crash-restarts or
+// a blank window. Profiles, most capable first:
+//   gpu       the full set
+//   gl        GPU compositing through ANGLE/GL only, Chromium fallbacks kept
+//   software  no GPU process work at all
+// The choice is cached in ~/.cache/pulse-browser-auth/gpu-profile together
+// with per-profile failure counts and startup times. A run is marked pending
+// before CEF starts and confirmed once the first frame has been presented,
+// unless the GPU process crashed before that. A finished page load is not
+// enough: a blank window loads pages fine. A run that never got a frame out
+// (GPU process abort, crash) is counted as a failure on the next start, and
+// kMaxGpuFailures in a row drop to the next profile. A GPU process crash, or
+// a page that loaded without ever presenting a frame, is conclusive: the
+// profile is failed outright and the next run starts on the one below it.
+enum GpuProfile { GPU_PROFILE_FULL = 0, GPU_PROFILE_GL, GPU_PROFILE_SOFTWARE, GPU_PROFILE_COUNT };
+const char* const kGpuProfileNames[GPU_PROFILE_COUNT] = {"gpu", "gl", "software"};
+const int kMaxGpuFailures = 2;
+struct GpuProfileState {
+    std::string pending;  // Profile of a run that has not confirmed yet
+    int failures[GPU_PROFILE_COUNT] = {};
+    int64_t startup_ms[GPU_PROFILE_COUNT] = {};  // Process start to first frame, last good run
+};
+std::string g_gpu_profile_request = "auto";  // --gpu-profile
+int g_gpu_profile = GPU_PROFILE_FULL;
+std::string g_gpu_state_file;
+std::atomic<bool> g_gpu_profile_confirmed{false};  // Read by the GPU process watch
+bool g_gpu_profile_exercised = false;  // A browser was created with it
+bool g_gpu_load_error_seen = false;    // Main-frame network error: inconclusive run
+// First main-frame load end; a frame is owed within kGpuFrameGraceMs of it
+std::chrono::steady_clock::time_point g_gpu_first_load;
+bool g_gpu_page_loaded = false;
+const int kGpuFrameGraceMs = 5000;
+std::mutex g_gpu_state_mutex;          // Serializes gpu-profile rewrites across threads
+std::string g_frame_marker;            // Per-process console marker of the first-frame probe
+std::atomic<int> g_gpu_crashes{0};     // GPU process exits seen by WatchGpuProcess
+std::atomic<bool> g_gpu_watch_stopped{false};
+std::chrono::steady_clock::time_point g_process_start;
+
+// Silent re-auth: while the IdP session is still valid the SAML flow completes
+// without user input, so run it first in a hidden windowless browser at 1 fps
+// (no window, no GPU compositing) and show the real window only if no DSID
+// arrives within g_silent_budget_seconds. 0 disables the silent attempt.
+int g_silent_budget_seconds = 0;
+
+// Daemon mode: one initialized CEF context serving auth requests over a UNIX
+// socket. Line protocol, one request per connection:
+//   AUTH <url> [timeout]  ->  DSID=<value> | ERROR <reason>
+//                             (with --json, the result object instead of
+//                             DSID=, gwcert/gwpin included)
+//   PING                  ->  PONG
+//   QUIT                  ->  daemon exits
+// Each AUTH opens a fresh browser window in the shared context; the process
+// exits after g_idle_timeout_seconds without a request.
+bool g_daemon_mode = false;
+std::string g_socket_path;
+int g_idle_timeout_seconds = 600;
+int g_listen_fd = -1;
+int g_result_pipe[2] = {-1, -1};  // UI thread -> listener: "session finished"
+std::mutex g_result_mutex;        // Guards AuthSession::daemon_reply
+std::atomic<bool> g_daemon_stopping{false};
+bool g_session_active = false;    // An AUTH is being served (UI thread)
+int g_daemon_requests = 0;  // AUTH requests begun (UI thread)
+
+// Lean profile (--lean): the auth browser lives for under a minute and only
+// renders one SSO flow, so switch off the Chromium subsystems that SAML,
+// WebAuthn and extensions don't need - background networking, component
+// updater, variations/field trials, safe-browsing and domain-reliability
+// fetches, spellcheck, sync, translate, media router, crash reporter. Only
+// switches that stop a background fetch or helper service outright are in
+// the set; nothing that touches navigation (the spare renderer that speeds
+// up the IdP's cross-site hops stays on). The METRICS record carries the
+// startup phases and the process count for before/after comparison
+// (bench/run_bench.py -- --lean).
+bool g_lean = false;
+
+// Memory budget (--memory-budget <MB>) for machines already short on RAM:
+// renderer processes are capped, the V8 old-space is limited to a quarter of
+// the budget, and extension processes are disabled when no --extension is
+// set. While it is active the RSS of this process tree is sampled every
+// second on CEF's background file thread by ProcessSampleTask, following
+// only our own children (/proc/<pid>/task/*/children), and the peak per
+// process type is reported at exit.
+int g_memory_budget_mb = 0;
+std::mutex g_peak_rss_mutex;
+std::vector<std::pair<std::string, int64_t>> g_peak_rss_kb;  // Process type -> peak summed RSS, guarded
 
 // "Mimic Pulse" mode: present as the official Pulse Secure CEF client.
 // Sets a single Linux UA matching the official client's signature
@@ -38,34 +412,1484 @@ std::string g_mimic_pulse_ua =
     "Chrome/142.0.0.0 Safari/537.36 PulseWebClient/22.8.R6.44527";
 
 // User agent switching state (legacy, non-mimic mode — for Okta bypass)
-// Start with Windows UA to bypass Okta's Linux blocking, then switch to Linux UA after first load
+// Start with Windows UA to bypass Okta's Linux blocking, then switch to Linux UA after first load.
+// The UA is picked per request, so the switch applies from the next navigation
+// on instead of through a forced reload of the landing page (--ua-reload
+// restores the old behaviour). The switch is per browser, so each gateway
+// window goes through its own stage. --ua-rule <host-glob>=windows|linux pins the UA
+// for matching hosts regardless of stage; rules are read on the IO thread and
+// immutable after startup.
+struct UARule {
+    std::string host;
+    bool linux_ua;
+};
+std::vector<UARule> g_ua_rules;
+bool g_ua_reload = false;
 std::string g_windows_ua = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/142.0.0.0 Safari/537.36";
 std::string g_linux_ua = "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/142.0.0.0 Safari/537.36";
-bool g_first_load_complete = false;
-bool g_ua_switched = false;
-bool g_startup_grace_period = true;
+
+// --extension is loaded on every run except for gateways known not to need
+// it: after kNoFormRunsToSkip sign-ins in a row finished without a password
+// field on the IdP pages (SSO cookie, Kerberos, FIDO-only), the host goes on
+// the skip list in <cache>/extension-skip-hosts ("<host> <runs> <epoch>") and
+// later runs start without the extension. The first password field seen
+// takes the host off again. Only that one login then runs without the
+// password manager: Chromium loads unpacked extensions only at start-up.
+// Entries not updated for kExtensionHostMaxAgeDays expire, so skipped hosts
+// are re-checked with the extension; at most kMaxExtensionHosts are kept.
+// --eager-extension and --daemon never skip.
+const int kNoFormRunsToSkip = 3;
+const int kExtensionHostMaxAgeDays = 30;
+const size_t kMaxExtensionHosts = 32;
+bool g_eager_extension = false;
+bool g_extension_loaded = false;          // --load-extension passed this run
+std::string g_extension_skip_file;
+// Reported by CredentialFormProbe. Not secret: a page that fakes it only
+// keeps the extension loaded for its host.
+const char* const kCredentialFormMarker = "pulse-auth-credential-form";
+
+// DNS off the critical path. The service flushes the resolver caches before
+// each connect, so after a resume every hop of the SAML chain would pay a
+// cold lookup, one after the other. The main-frame hosts of the last
+// successful flow per gateway are kept in <cache>/resolve-hosts. Right
+// after CefInitialize they are all handed to Chromium's own resolver at once
+// (CefRequestContext::ResolveHost), which fills its host cache with every
+// address while the browser is still being created. Nothing waits for the
+// answers and nothing is pinned, so the navigations keep Chromium's address
+// fallback. Only --resolve host:ip from the caller maps a host explicitly,
+// with host-resolver-rules.
+const size_t kMaxResolveHostsPerGateway = 8;
+std::string g_resolve_hosts_file;
+std::vector<std::pair<std::string, std::string>> g_resolve_overrides;  // --resolve, in order
+// --trust-spki: base64 SHA-256 SPKI pins (comma-separated) whose certificates
+// are accepted for the gateway hosts only, see OnCertificateError. Used for
+// the auth-dialog's local capture proxy, which the gateway host is pointed
+// at with --resolve in race mode; the IdP's hosts keep normal verification.
+std::string g_trust_spki;
+
+// --trace-file: Chromium tracing from just before the first CreateBrowser
+// until the flow ends (DSID committed, timeout, window closed). The JSON is
+// written before the message loop quits and opens in Perfetto or
+// chrome://tracing. Not available with --daemon.
+const char* kTraceCategories =
+    "toplevel,startup,navigation,loading,net,netlog,blink,v8,renderer_host,"
+    "gpu,viz,cc,disabled-by-default-devtools.timeline";
+std::string g_trace_file;
+
+// --persist-cookies: domain globs (e.g. "*.okta.com") whose session cookies
+// survive restarts, so a still-valid IdP/MFA session completes the flow
+// without user input. CefSettings.persist_session_cookies is all-or-nothing:
+// with a list given it is turned on and every other session cookie is purged
+// at start-up. The gateways' DSID is deleted before the first browser opens
+// either way, so the cookie scanner never sees one from an earlier run.
+std::vector<std::string> g_persist_cookie_domains;
+
+// Realm shortcut. The bare gateway URL bounces through the landing page and
+// realm selection before the realm's SSO endpoint redirects to the IdP, each
+// hop a round trip to the gateway. The gateway URL a successful flow left
+// from for the IdP is kept per gateway in <cache>/entry-urls, and the next
+// flow starts there. If that URL fails to load, answers with an HTTP error,
+// ends up on another gateway page, or sits on its own page for
+// kEntryShortcutGraceMs without moving on to the IdP (a SAML POST binding
+// form submits itself well before that), it is forgotten and the gateway URL
+// is loaded in the same browser. --no-entry-shortcut turns this off.
+const int kEntryShortcutGraceMs = 3000;
+bool g_entry_shortcut = true;
+std::string g_entry_urls_file;
 
 // Forward declarations
-void ScheduleCookieCheck();
-void CheckAndCloseBrowser();
+void ScheduleTimeoutCheck(const std::shared_ptr<AuthSession>& session);
+void ScanCookieStore(const std::shared_ptr<AuthSession>& session, size_t gateway);
+void AcceptDSID(const std::shared_ptr<AuthSession>& session, size_t gateway, const std::string& value);
+void RecordDSIDCandidate(const std::shared_ptr<AuthSession>& session, size_t gateway,
+                         const std::string& value, int status, const char* source);
+void EndDaemonSession(AuthSession& session);
+void QuitWhenSettled(const std::shared_ptr<AuthSession>& session);
+void CreateVisibleBrowser(const std::shared_ptr<AuthSession>& session, size_t gateway);
+void CreateAuthBrowser(const std::shared_ptr<AuthSession>& session);
+void StartRemainingGateways(const std::shared_ptr<AuthSession>& session);
+void StartBrowserFlow(const std::shared_ptr<AuthSession>& session);
+void FailGpuProfile(const char* reason);
+
+// Extract the lowercase host from a URL ("https://vpn.example.com:443/saml" ->
+// "vpn.example.com"). Plain string parsing so it is usable on any thread and
+// before CefInitialize.
+std::string HostFromUrl(const std::string& url) {
+    std::string rest = url;
+    auto scheme = rest.find("://");
+    if (scheme != std::string::npos) {
+        rest = rest.substr(scheme + 3);
+    }
+    auto end = rest.find_first_of("/?#");
+    if (end != std::string::npos) {
+        rest = rest.substr(0, end);
+    }
+    auto at = rest.rfind('@');
+    if (at != std::string::npos) {
+        rest = rest.substr(at + 1);
+    }
+    auto colon = rest.rfind(':');
+    if (colon != std::string::npos && rest.find(']') == std::string::npos) {
+        rest = rest.substr(0, colon);
+    }
+    for (auto& c : rest) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return rest;
+}
+
+std::vector<std::string> HostsFromUrls(const std::vector<std::string>& urls) {
+    std::vector<std::string> hosts;
+    for (const auto& url : urls) hosts.push_back(HostFromUrl(url));
+    return hosts;
+}
+
+// main() and daemon session start, UI thread
+AuthSession::AuthSession(const std::vector<std::string>& urls, int timeout_seconds)
+    : start_time(std::chrono::steady_clock::now()),
+      deadline(start_time + std::chrono::seconds(timeout_seconds)),
+      hosts(HostsFromUrls(urls)) {
+    for (size_t i = 0; i < urls.size(); i++) {
+        GatewayAuth gw;
+        gw.url = urls[i];
+        gw.host = hosts[i];
+        gateways.push_back(std::move(gw));
+    }
+    if (!g_waterfall_file.empty()) {
+        waterfall = std::vector<WaterfallEntry>(kWaterfallEntries);
+        waterfall_open.reserve(kWaterfallEntries);
+    }
+}
+
+bool AllBrowsersClosed(const AuthSession& session) {
+    for (const auto& gw : session.gateways) {
+        if (gw.browser || gw.creating) return false;
+    }
+    return true;
+}
+
+void CloseAllBrowsers(const AuthSession& session) {
+    for (const auto& gw : session.gateways) {
+        if (gw.browser) gw.browser->GetHost()->CloseBrowser(true);
+    }
+}
+
+// Path of a URL without query/fragment ("https://h/a/b?x" -> "/a/b")
+std::string PathFromUrl(const std::string& url) {
+    auto scheme = url.find("://");
+    auto start = url.find('/', scheme == std::string::npos ? 0 : scheme + 3);
+    if (start == std::string::npos) return "/";
+    auto end = url.find_first_of("?#", start);
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+const std::pair<const char*, int> kResourceTypeNames[] = {
+    {"main_frame", RT_MAIN_FRAME},     {"sub_frame", RT_SUB_FRAME},
+    {"stylesheet", RT_STYLESHEET},     {"script", RT_SCRIPT},
+    {"image", RT_IMAGE},               {"font", RT_FONT_RESOURCE},
+    {"sub_resource", RT_SUB_RESOURCE}, {"object", RT_OBJECT},
+    {"media", RT_MEDIA},               {"worker", RT_WORKER},
+    {"shared_worker", RT_SHARED_WORKER}, {"prefetch", RT_PREFETCH},
+    {"favicon", RT_FAVICON},           {"xhr", RT_XHR},
+    {"ping", RT_PING},                 {"service_worker", RT_SERVICE_WORKER},
+    {"csp_report", RT_CSP_REPORT},     {"plugin", RT_PLUGIN_RESOURCE},
+};
+
+// Parse the --block-rules file; false (after logging the offending line) on error
+bool LoadBlockRules(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot read block rules " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+        lineno++;
+        auto hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+
+        std::vector<std::string> tokens;
+        size_t pos = 0;
+        while ((pos = line.find_first_not_of(" \t\r", pos)) != std::string::npos) {
+            auto end = line.find_first_of(" \t\r", pos);
+            tokens.push_back(line.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+            pos = end;
+        }
+        if (tokens.empty()) continue;
+
+        BlockRule rule;
+        bool ok = tokens.size() > 1 && (tokens[0] == "allow" || tokens[0] == "deny");
+        rule.allow = tokens[0] == "allow";
+        for (size_t i = 1; ok && i < tokens.size(); i++) {
+            const std::string& t = tokens[i];
+            if (t.rfind("host=", 0) == 0) {
+                rule.host = t.substr(5);
+                for (auto& c : rule.host) {
+                    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                }
+            } else if (t.rfind("path=", 0) == 0) {
+                rule.path = t.substr(5);
+            } else if (t.rfind("type=", 0) == 0) {
+                std::string list = t.substr(5) + ",";
+                size_t start = 0, comma;
+                while (ok && (comma = list.find(',', start)) != std::string::npos) {
+                    std::string name = list.substr(start, comma - start);
+                    start = comma + 1;
+                    if (name.empty()) continue;
+                    ok = false;
+                    for (const auto& entry : kResourceTypeNames) {
+                        if (name == entry.first) {
+                            rule.types.push_back(entry.second);
+                            ok = true;
+                        }
+                    }
+                }
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            std::cerr << path << ":" << lineno << ": invalid block rule" << std::endl;
+            return false;
+        }
+        g_block_rules.push_back(rule);
+    }
+    std::cerr << "Loaded " << g_block_rules.size() << " resource block rules" << std::endl;
+    return true;
+}
+
+// True if the request should be cancelled (IO thread)
+bool ShouldBlockRequest(const AuthSession& session, const std::string& url, int type) {
+    if (g_block_rules.empty() || type == RT_MAIN_FRAME ||
+        type == RT_NAVIGATION_PRELOAD_MAIN_FRAME) {
+        return false;
+    }
+    std::string host = HostFromUrl(url);
+    if (session.IsGatewayHost(host)) return false;
+    std::string path = PathFromUrl(url);
+    for (const auto& rule : g_block_rules) {
+        if (!rule.host.empty() && fnmatch(rule.host.c_str(), host.c_str(), 0) != 0) continue;
+        if (!rule.path.empty() && fnmatch(rule.path.c_str(), path.c_str(), 0) != 0) continue;
+        if (!rule.types.empty() &&
+            std::find(rule.types.begin(), rule.types.end(), type) == rule.types.end()) continue;
+        return !rule.allow;
+    }
+    return false;
+}
+
+// Blocked request count and estimated bytes saved for a run
+std::pair<int64_t, int64_t> BlockedTotals(const AuthSession& session) {
+    int64_t requests = 0, bytes = 0;
+    for (int t = 0; t < RT_NUM_VALUES; t++) {
+        int64_t blocked = session.blocked_count[t].load();
+        int64_t loaded = session.loaded_count[t].load();
+        requests += blocked;
+        if (loaded > 0) bytes += blocked * (session.loaded_bytes[t].load() / loaded);
+    }
+    return {requests, bytes};
+}
+
+bool HasPhase(const std::vector<std::pair<std::string, int64_t>>& marks, const char* phase) {
+    return std::any_of(marks.begin(), marks.end(), [&](const auto& mark) { return mark.first == phase; });
+}
+
+// Record the first time a phase is reached (UI thread). Session-wide phases
+// go on the session, flow phases on the gateway that reached them.
+void MarkPhase(AuthSession& session, const char* phase) {
+    if (!HasPhase(session.phase_marks, phase)) session.phase_marks.emplace_back(phase, session.ElapsedMs());
+}
+
+void MarkPhase(AuthSession& session, GatewayAuth& gw, const char* phase) {
+    if (!HasPhase(gw.phase_marks, phase)) gw.phase_marks.emplace_back(phase, session.ElapsedMs());
+}
+
+// Direct children of pid, from the per-thread children lists. False if the
+// kernel doesn't provide them (CONFIG_PROC_CHILDREN).
+bool ChildPids(int pid, std::vector<int>& children) {
+    std::error_code ec;
+    std::filesystem::directory_iterator it("/proc/" + std::to_string(pid) + "/task", ec), end;
+    if (ec) return false;
+    for (; it != end; it.increment(ec)) {
+        std::ifstream in(it->path() / "children");
+        if (!in) return false;
+        int child;
+        while (in >> child) children.push_back(child);
+    }
+    return true;
+}
+
+// PIDs of all processes descended from this one (CEF's GPU, utility,
+// zygote, renderer and extension processes). Walks down from this process;
+// only without children lists does it scan all of /proc.
+std::vector<int> DescendantPids() {
+    std::vector<int> result = {static_cast<int>(getpid())};
+    bool walked = true;
+    for (size_t i = 0; i < result.size() && walked; i++) {
+        walked = ChildPids(result[i], result);
+    }
+    if (walked) {
+        result.erase(result.begin());
+        return result;
+    }
+
+    std::vector<std::pair<int, int>> procs;  // pid, ppid
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it("/proc", ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.empty() || !std::isdigit(static_cast<unsigned char>(name[0]))) continue;
+        std::ifstream in(it->path() / "stat");
+        std::string stat;
+        if (!std::getline(in, stat)) continue;
+        // "pid (comm) state ppid ..." - comm may contain spaces
+        auto paren = stat.rfind(')');
+        if (paren == std::string::npos || paren + 4 >= stat.size()) continue;
+        procs.emplace_back(std::atoi(name.c_str()), std::atoi(stat.c_str() + paren + 4));
+    }
+    result = {static_cast<int>(getpid())};
+    for (size_t i = 0; i < result.size(); i++) {
+        for (const auto& proc : procs) {
+            if (proc.second == result[i]) result.push_back(proc.first);
+        }
+    }
+    result.erase(result.begin());
+    return result;
+}
+
+// Chromium process type from /proc/<pid>/cmdline: "browser", "renderer",
+// "extension", "gpu-process", "utility", "zygote", ...
+std::string ProcessType(int pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/cmdline", std::ios::binary);
+    std::string arg, type = "browser";
+    bool extension = false;
+    while (std::getline(in, arg, '\0')) {
+        if (arg.rfind("--type=", 0) == 0) type = arg.substr(7);
+        if (arg == "--extension-process") extension = true;
+    }
+    return type == "renderer" && extension ? "extension" : type;
+}
+
+int64_t ProcessRssKb(int pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) return std::atoll(line.c_str() + 6);
+    }
+    return 0;
+}
+
+// Fold the current RSS of this process tree into the per-type peaks
+void SampleProcessMemory(const std::vector<int>& descendants) {
+    std::vector<std::pair<std::string, int64_t>> now = {{"browser", ProcessRssKb(getpid())}};
+    for (int pid : descendants) {
+        std::string type = ProcessType(pid);
+        auto it = std::find_if(now.begin(), now.end(), [&](const auto& e) { return e.first == type; });
+        if (it == now.end()) {
+            now.emplace_back(type, ProcessRssKb(pid));
+        } else {
+            it->second += ProcessRssKb(pid);
+        }
+    }
+    std::lock_guard<std::mutex> lock(g_peak_rss_mutex);
+    for (const auto& sample : now) {
+        auto it = std::find_if(g_peak_rss_kb.begin(), g_peak_rss_kb.end(),
+                               [&](const auto& e) { return e.first == sample.first; });
+        if (it == g_peak_rss_kb.end()) {
+            g_peak_rss_kb.push_back(sample);
+        } else {
+            it->second = std::max(it->second, sample.second);
+        }
+    }
+}
+
+// Chromium relaunches a crashed GPU process without telling the embedder, so
+// watch its pid instead: a GPU process that goes away, or comes back under
+// another pid, while the message loop still runs is a crash. Called from
+// ProcessSampleTask until the profile is confirmed; returns the GPU process
+// pid now (0 if there is none).
+int WatchGpuProcess(const std::vector<int>& descendants, int gpu_pid) {
+    int pid = 0;
+    for (int child : descendants) {
+        if (ProcessType(child) == "gpu-process") {
+            pid = child;
+            break;
+        }
+    }
+    if (gpu_pid && pid != gpu_pid && !g_gpu_watch_stopped) {
+        g_gpu_crashes++;
+        std::cerr << "GPU process " << gpu_pid << " exited with the " << kGpuProfileNames[g_gpu_profile]
+                  << " rendering profile" << std::endl;
+        // Written now rather than at exit: the run may still be killed
+        // once its DSID is out
+        if (g_gpu_crashes == 1) FailGpuProfile("its GPU process crashed");
+    }
+    return pid;
+}
+
+// Once a second on TID_FILE_BACKGROUND, so the /proc walks stay off the UI
+// thread: the session's process count always, RSS per process type under a
+// memory budget, and the GPU process until the rendering profile is
+// confirmed. Runs from browser creation until the session's result is out,
+// so an idle daemon polls nothing.
+class ProcessSampleTask : public CefTask {
+public:
+    explicit ProcessSampleTask(std::shared_ptr<AuthSession> session, int gpu_pid = 0)
+        : session_(std::move(session)), gpu_pid_(gpu_pid) {}
+    void Execute() override {
+        if (!session_->sampling) return;
+        std::vector<int> pids = DescendantPids();
+        int count = static_cast<int>(pids.size());
+        int seen = session_->process_count.load();
+        while (count > seen && !session_->process_count.compare_exchange_weak(seen, count)) {}
+        if (g_memory_budget_mb > 0) SampleProcessMemory(pids);
+        bool watching = !g_gpu_profile_confirmed && !g_gpu_watch_stopped && g_gpu_crashes == 0;
+        int gpu_pid = watching ? WatchGpuProcess(pids, gpu_pid_) : 0;
+        CefPostDelayedTask(TID_FILE_BACKGROUND, new ProcessSampleTask(session_, gpu_pid), 1000);
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    int gpu_pid_;
+    IMPLEMENT_REFCOUNTING(ProcessSampleTask);
+};
+
 
-// Task to end the startup grace period (allow new tabs after initial extension startup)
-class EndGracePeriodTask : public CefTask {
+void ReportPeakMemory() {
+    if (g_memory_budget_mb <= 0) return;
+    std::lock_guard<std::mutex> lock(g_peak_rss_mutex);
+    int64_t total = 0;
+    std::cerr << "Peak RSS:";
+    for (const auto& peak : g_peak_rss_kb) {
+        std::cerr << " " << peak.first << "=" << peak.second / 1024 << "MiB";
+        total += peak.second;
+    }
+    std::cerr << " (sum of peaks " << total / 1024 << "/" << g_memory_budget_mb
+              << " MiB budget)" << std::endl;
+}
+
+// Minimal JSON string escaping for hosts and close reasons
+std::string JsonEscape(const std::string& in) {
+    std::string out;
+    for (char c : in) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// Emit the timing record for the run that just ended. Never includes the DSID.
+std::string PhasesJson(const AuthSession& session, const GatewayAuth& gw) {
+    std::string json = "{";
+    for (const auto* marks : {&session.phase_marks, &gw.phase_marks}) {
+        for (const auto& mark : *marks) {
+            if (json.size() > 1) json += ",";
+            json += "\"" + mark.first + "\":" + std::to_string(mark.second);
+        }
+    }
+    return json + "}";
+}
+
+// In-flight waterfall entry of a request (IO thread)
+WaterfallEntry* FindWaterfallEntry(AuthSession& session, uint64_t id) {
+    auto it = session.waterfall_open.find(id);
+    if (it == session.waterfall_open.end()) return nullptr;
+    return &session.waterfall[it->second % session.waterfall.size()];
+}
+
+void WaterfallStart(AuthSession& session, uint64_t id, const std::string& url, int type) {
+    // Already open: the redirect that led here started it
+    if (session.waterfall.empty() || session.waterfall_open.count(id)) return;
+    uint64_t index = session.waterfall_next;
+    WaterfallEntry& entry = session.waterfall[index % session.waterfall.size()];
+    // The ring wrapped onto a request that never completed: it is dropped
+    if (entry.state == 1) session.waterfall_open.erase(entry.id);
+    entry.id = id;
+    entry.type = type;
+    entry.status = 0;
+    entry.failed = false;
+    entry.bytes = 0;
+    entry.start_ms = session.ElapsedMs();
+    entry.response_ms = -1;
+    entry.end_ms = -1;
+    snprintf(entry.host, sizeof(entry.host), "%s", HostFromUrl(url).c_str());
+    snprintf(entry.path, sizeof(entry.path), "%s", PathFromUrl(url).c_str());
+    entry.state = 1;
+    session.waterfall_open[id] = index;
+    session.waterfall_next = index + 1;
+}
+
+void WaterfallResponse(AuthSession& session, uint64_t id, CefRefPtr<CefResponse> response) {
+    WaterfallEntry* entry = FindWaterfallEntry(session, id);
+    if (!entry || entry->response_ms >= 0) return;
+    entry->response_ms = session.ElapsedMs();
+    entry->status = response->GetStatus();
+}
+
+void WaterfallComplete(AuthSession& session, uint64_t id, CefRefPtr<CefResponse> response,
+                       bool failed, int64_t bytes) {
+    WaterfallEntry* entry = FindWaterfallEntry(session, id);
+    if (!entry) return;
+    if (entry->response_ms < 0 && response) WaterfallResponse(session, id, response);
+    entry->end_ms = session.ElapsedMs();
+    entry->failed = failed;
+    entry->bytes = bytes;
+    entry->state = 2;
+    session.waterfall_open.erase(id);
+}
+
+// A redirect ends its hop's entry and opens one for the target
+void WaterfallRedirect(AuthSession& session, uint64_t id, CefRefPtr<CefResponse> response,
+                       const std::string& new_url, int type) {
+    WaterfallEntry* entry = FindWaterfallEntry(session, id);
+    if (!entry) return;
+    WaterfallComplete(session, id, response, false, 0);
+    WaterfallStart(session, id, new_url, type);
+}
+
+// A run's waterfall as one JSON line (IO thread)
+std::string WaterfallJson(const AuthSession& session, const std::string& result) {
+    const std::vector<WaterfallEntry>& ring = session.waterfall;
+    uint64_t recorded = session.waterfall_next;
+    uint64_t first = recorded > ring.size() ? recorded - ring.size() : 0;
+    std::string json = "{\"event\":\"auth_waterfall\"";
+    json += ",\"result\":\"" + JsonEscape(result) + "\"";
+    json += ",\"host\":\"" + JsonEscape(session.hosts.empty() ? "" : session.hosts[0]) + "\"";
+    json += ",\"recorded\":" + std::to_string(recorded);
+    json += ",\"dropped\":" + std::to_string(first);
+    json += ",\"requests\":[";
+    bool separator = false;
+    for (uint64_t i = first; i < recorded; i++) {
+        const WaterfallEntry& entry = ring[i % ring.size()];
+        int state = entry.state;
+        if (state == 0) continue;
+        const char* type = "other";
+        for (const auto& name : kResourceTypeNames) {
+            if (name.second == entry.type) type = name.first;
+        }
+        if (separator) json += ",";
+        separator = true;
+        json += "{\"host\":\"" + JsonEscape(entry.host) + "\"";
+        json += ",\"path\":\"" + JsonEscape(entry.path) + "\"";
+        json += std::string(",\"type\":\"") + type + "\"";
+        json += ",\"status\":" + std::to_string(entry.status);
+        json += ",\"bytes\":" + std::to_string(entry.bytes);
+        json += ",\"start_ms\":" + std::to_string(entry.start_ms);
+        json += ",\"response_ms\":" + (entry.response_ms >= 0 ? std::to_string(entry.response_ms) : "null");
+        // Still in flight when the flow ended
+        json += ",\"end_ms\":" + (state == 2 ? std::to_string(entry.end_ms) : "null");
+        if (entry.failed) json += ",\"failed\":true";
+        json += "}";
+    }
+    return json + "]}";
+}
+
+// Append one serialized waterfall to g_waterfall_file (file thread)
+class WaterfallWriteTask : public CefTask {
 public:
-    void Execute() override { g_startup_grace_period = false; }
+    explicit WaterfallWriteTask(std::string json) : json_(std::move(json)) {}
+    void Execute() override {
+        std::error_code ec;
+        if (static_cast<int64_t>(std::filesystem::file_size(g_waterfall_file, ec)) > kWaterfallFileMaxBytes && !ec) {
+            std::filesystem::rename(g_waterfall_file, g_waterfall_file + ".1", ec);
+        }
+        std::ofstream out(g_waterfall_file, std::ios::app);
+        if (out) {
+            out << json_ << '\n';
+        } else {
+            std::cerr << "Failed to write the request waterfall to " << g_waterfall_file << std::endl;
+        }
+    }
 private:
-    IMPLEMENT_REFCOUNTING(EndGracePeriodTask);
+    std::string json_;
+    IMPLEMENT_REFCOUNTING(WaterfallWriteTask);
 };
 
-// Resource request handler to modify User-Agent header per request
+// Serialize the ring where it is written, then hand the line to the file thread
+class WaterfallSnapshotTask : public CefTask {
+public:
+    WaterfallSnapshotTask(std::shared_ptr<const AuthSession> session, std::string result)
+        : session_(std::move(session)), result_(std::move(result)) {}
+    void Execute() override {
+        CefPostTask(TID_FILE_BACKGROUND, new WaterfallWriteTask(WaterfallJson(*session_, result_)));
+    }
+private:
+    std::shared_ptr<const AuthSession> session_;
+    std::string result_;
+    IMPLEMENT_REFCOUNTING(WaterfallSnapshotTask);
+};
+
+// Append a run's waterfall to g_waterfall_file (UI thread, once per run)
+void WriteWaterfall(const AuthSession& session, const std::string& result) {
+    if (session.waterfall.empty()) return;
+    CefPostTask(TID_IO, new WaterfallSnapshotTask(session.shared_from_this(), result));
+}
+
+void EmitTimingMetrics(const AuthSession& session, const std::string& result) {
+    if (!g_block_rules.empty()) {
+        auto blocked = BlockedTotals(session);
+        std::cerr << "Blocked " << blocked.first << " requests (~"
+                  << blocked.second / 1024 << " KiB saved)" << std::endl;
+    }
+    std::string json = "{\"event\":\"auth_timing\"";
+    json += ",\"result\":\"" + JsonEscape(result) + "\"";
+    json += ",\"host\":\"" + JsonEscape(session.hosts.empty() ? "" : session.hosts[0]) + "\"";
+    json += ",\"gateways\":" + std::to_string(session.gateways.size());
+    json += std::string(",\"mode\":\"") + (g_mimic_pulse ? "mimic" : "legacy") + "\"";
+    json += std::string(",\"silent\":") + (g_silent_budget_seconds > 0 ? "true" : "false");
+    json += std::string(",\"warm\":") + (g_daemon_mode ? "true" : "false");
+    json += std::string(",\"gpu_profile\":\"") + kGpuProfileNames[g_gpu_profile] + "\"";
+    json += ",\"gpu_crashes\":" + std::to_string(g_gpu_crashes.load());
+    json += ",\"phases_ms\":" + PhasesJson(session, session.gateways[0]);
+    if (session.gateways.size() > 1) {
+        json += ",\"gateway_phases_ms\":{";
+        for (size_t i = 1; i < session.gateways.size(); i++) {
+            if (i > 1) json += ",";
+            json += "\"" + JsonEscape(session.gateways[i].host) + "\":" + PhasesJson(session, session.gateways[i]);
+        }
+        json += "}";
+    }
+    json += ",\"navigations\":" + std::to_string(session.navigation_count);
+    json += ",\"redirects\":" + std::to_string(session.redirect_count);
+    int entry_shortcuts = 0;
+    for (const auto& gw : session.gateways) entry_shortcuts += gw.entry_url.empty() ? 0 : 1;
+    json += ",\"entry_shortcuts\":" + std::to_string(entry_shortcuts);
+    size_t candidates = 0;
+    for (const auto& gw : session.gateways) candidates += gw.candidates.size();
+    json += ",\"dsid_candidates\":" + std::to_string(candidates);
+    int renderer_crashes = 0;
+    for (const auto& gw : session.gateways) renderer_crashes += gw.renderer_crashes;
+    json += ",\"renderer_crashes\":" + std::to_string(renderer_crashes);
+    int64_t loaded_bytes = 0;
+    for (int t = 0; t < RT_NUM_VALUES; t++) loaded_bytes += session.loaded_bytes[t].load();
+    auto blocked = BlockedTotals(session);
+    json += ",\"loaded_bytes\":" + std::to_string(loaded_bytes);
+    json += ",\"blocked_requests\":" + std::to_string(blocked.first);
+    json += ",\"blocked_bytes_est\":" + std::to_string(blocked.second);
+    json += std::string(",\"lean\":") + (g_lean ? "true" : "false");
+    json += ",\"processes\":" + std::to_string(session.process_count.load());
+    if (g_memory_budget_mb > 0) {
+        std::lock_guard<std::mutex> lock(g_peak_rss_mutex);
+        json += ",\"peak_rss_kb\":{";
+        for (size_t i = 0; i < g_peak_rss_kb.size(); i++) {
+            if (i) json += ",";
+            json += "\"" + JsonEscape(g_peak_rss_kb[i].first) + "\":" + std::to_string(g_peak_rss_kb[i].second);
+        }
+        json += "}";
+    }
+    json += ",\"total_ms\":" + std::to_string(session.ElapsedMs());
+    json += "}";
+
+    if (g_metrics_file.empty()) {
+        std::cerr << "METRICS " << json << std::endl;
+    } else {
+        std::ofstream out(g_metrics_file, std::ios::app);
+        if (out) {
+            out << json << '\n';
+        } else {
+            std::cerr << "Failed to write metrics to " << g_metrics_file << std::endl;
+        }
+    }
+    WriteWaterfall(session, result);
+}
+
+// SHA-256 (FIPS 180-4). CEF exposes the certificate but no digest API, and
+// this is the only hashing the binary needs.
+std::vector<uint8_t> Sha256(const uint8_t* data, size_t len) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    std::vector<uint8_t> msg(data, data + len);
+    msg.push_back(0x80);
+    while (msg.size() % 64 != 56) msg.push_back(0);
+    uint64_t bits = static_cast<uint64_t>(len) * 8;
+    for (int i = 7; i >= 0; i--) msg.push_back(static_cast<uint8_t>(bits >> (i * 8)));
+
+    auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t(msg[off + 4 * i]) << 24) | (uint32_t(msg[off + 4 * i + 1]) << 16) |
+                   (uint32_t(msg[off + 4 * i + 2]) << 8) | uint32_t(msg[off + 4 * i + 3]);
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+    std::vector<uint8_t> digest;
+    for (uint32_t word : h) {
+        for (int i = 3; i >= 0; i--) digest.push_back(static_cast<uint8_t>(word >> (i * 8)));
+    }
+    return digest;
+}
+
+std::string HexEncode(const std::vector<uint8_t>& bytes) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (uint8_t b : bytes) {
+        out += digits[b >> 4];
+        out += digits[b & 0xf];
+    }
+    return out;
+}
+
+std::string Base64Encode(const std::vector<uint8_t>& bytes) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t n = uint32_t(bytes[i]) << 16;
+        if (i + 1 < bytes.size()) n |= uint32_t(bytes[i + 1]) << 8;
+        if (i + 2 < bytes.size()) n |= bytes[i + 2];
+        out += table[(n >> 18) & 63];
+        out += table[(n >> 12) & 63];
+        out += i + 1 < bytes.size() ? table[(n >> 6) & 63] : '=';
+        out += i + 2 < bytes.size() ? table[n & 63] : '=';
+    }
+    return out;
+}
+
+// Read the DER TLV at der[pos]: returns false if malformed, otherwise sets
+// the tag, the offset of the contents and the offset just past the element
+bool ReadDerElement(const std::vector<uint8_t>& der, size_t pos,
+                    uint8_t& tag, size_t& content, size_t& end) {
+    if (pos + 2 > der.size()) return false;
+    tag = der[pos];
+    size_t len = der[pos + 1];
+    content = pos + 2;
+    if (len & 0x80) {
+        size_t count = len & 0x7f;
+        if (count == 0 || count > 4 || content + count > der.size()) return false;
+        len = 0;
+        for (size_t i = 0; i < count; i++) len = (len << 8) | der[content + i];
+        content += count;
+    }
+    if (content + len > der.size()) return false;
+    end = content + len;
+    return true;
+}
+
+// openconnect's --servercert pin: base64 SHA-256 of the certificate's
+// SubjectPublicKeyInfo (RFC 7469). That is the seventh element of
+// tbsCertificate when the [0] version tag is present, the sixth otherwise.
+std::string SpkiPin(const std::vector<uint8_t>& der) {
+    uint8_t tag;
+    size_t content, end;
+    if (!ReadDerElement(der, 0, tag, content, end) || tag != 0x30) return "";
+    if (!ReadDerElement(der, content, tag, content, end) || tag != 0x30) return "";
+    size_t pos = content;
+    size_t tbs_end = end;
+    if (!ReadDerElement(der, pos, tag, content, end)) return "";
+    if (tag == 0xa0) pos = end;  // version
+    for (int skip = 0; skip < 5; skip++) {  // serial, signature, issuer, validity, subject
+        if (!ReadDerElement(der, pos, tag, content, end) || end > tbs_end) return "";
+        pos = end;
+    }
+    if (!ReadDerElement(der, pos, tag, content, end) || tag != 0x30) return "";
+    return "pin-sha256:" + Base64Encode(Sha256(der.data() + pos, end - pos));
+}
+
+// Record the gateway's TLS certificate from the committed navigation (UI
+// thread). Only pages served by the gateway itself count, never the IdP's.
+void CaptureGatewayCert(GatewayAuth& gw, CefRefPtr<CefBrowser> browser) {
+    if (!gw.gwcert.empty()) return;
+    CefRefPtr<CefNavigationEntry> entry = browser->GetHost()->GetVisibleNavigationEntry();
+    if (!entry || !entry->IsValid() || HostFromUrl(entry->GetURL().ToString()) != gw.host) return;
+    CefRefPtr<CefSSLStatus> ssl = entry->GetSSLStatus();
+    if (!ssl || !ssl->IsSecureConnection()) return;
+    CefRefPtr<CefX509Certificate> cert = ssl->GetX509Certificate();
+    CefRefPtr<CefBinaryValue> encoded = cert ? cert->GetDEREncoded() : nullptr;
+    if (!encoded || encoded->GetSize() == 0) return;
+    std::vector<uint8_t> der(encoded->GetSize());
+    encoded->GetData(der.data(), der.size(), 0);
+    gw.gwcert = "sha256:" + HexEncode(Sha256(der.data(), der.size()));
+    gw.gwpin = SpkiPin(der);
+}
+
+// A certificate that failed verification is one of the --trust-spki pins
+bool TrustedSpki(CefRefPtr<CefSSLInfo> ssl_info) {
+    if (g_trust_spki.empty() || !ssl_info) return false;
+    CefRefPtr<CefX509Certificate> cert = ssl_info->GetX509Certificate();
+    CefRefPtr<CefBinaryValue> encoded = cert ? cert->GetDEREncoded() : nullptr;
+    if (!encoded || encoded->GetSize() == 0) return false;
+    std::vector<uint8_t> der(encoded->GetSize());
+    encoded->GetData(der.data(), der.size(), 0);
+    std::string pin = SpkiPin(der);
+    if (pin.empty()) return false;
+    pin = pin.substr(strlen("pin-sha256:"));
+    std::istringstream pins(g_trust_spki);
+    std::string trusted;
+    while (std::getline(pins, trusted, ',')) {
+        if (trusted == pin) return true;
+    }
+    return false;
+}
+
+// The --json result for one gateway: proxy.py's {"dsid", "gwcert",
+// "candidates"} plus the SPKI pin and the per-phase timings
+std::string ResultJson(const AuthSession& session, const GatewayAuth& gw) {
+    std::string json = "{\"url\":\"" + JsonEscape(gw.url) + "\"";
+    json += ",\"dsid\":" + (gw.found ? "\"" + JsonEscape(gw.dsid) + "\"" : std::string("null"));
+    json += ",\"gwcert\":\"" + gw.gwcert + "\"";
+    json += ",\"gwpin\":\"" + gw.gwpin + "\"";
+    json += ",\"candidates\":[";
+    for (size_t i = 0; i < gw.candidates.size(); i++) {
+        const DSIDCandidate& c = gw.candidates[i];
+        if (i) json += ",";
+        json += "{\"dsid\":\"" + JsonEscape(c.value) + "\"";
+        json += ",\"response_status\":" + std::to_string(c.status);
+        json += ",\"source\":\"" + c.source + "\"";
+        json += ",\"elapsed_ms\":" + std::to_string(c.elapsed_ms);
+        json += std::string(",\"committable\":") + (c.committable ? "true" : "false") + "}";
+    }
+    json += "]";
+    json += ",\"renderer_crashes\":" + std::to_string(gw.renderer_crashes);
+    json += ",\"phases_ms\":" + PhasesJson(session, gw);
+    json += ",\"total_ms\":" + std::to_string(session.ElapsedMs());
+    return json + "}";
+}
+
+// Write the result to stdout the moment it is known instead of after
+// CefShutdown: the caller can start openconnect while the browser closes,
+// the cookie store flushes and Chromium shuts down. Our stdout is then
+// pointed at /dev/null; CEF's helper processes still hold the inherited
+// pipe, so callers read lines rather than wait for EOF. Once per session.
+void EmitResult(AuthSession& session) {
+    if (session.result_emitted || g_daemon_mode) return;
+    session.result_emitted = true;
+    session.sampling = false;
+    std::ostream& out = *session.result_out;
+
+    // "DSID=<value>" for a single gateway, otherwise "DSID=<value> <url>" per
+    // gateway that completed, in --url order. With --json, one result object
+    // per gateway, including the failed ones.
+    for (const auto& gw : session.gateways) {
+        if (g_json_output) {
+            out << ResultJson(session, gw) << '\n';
+        } else if (gw.found) {
+            out << "DSID=" << gw.dsid;
+            if (session.gateways.size() > 1) out << " " << gw.url;
+            out << '\n';
+        } else if (session.gateways.size() > 1) {
+            std::cerr << "No DSID for " << gw.url << std::endl;
+        }
+    }
+    out.flush();
+
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (devnull >= 0) {
+        dup2(devnull, session.result_fd);
+        close(devnull);
+    }
+
+    // After the flush: the caller acts on the first stdout line, so metrics
+    // and the waterfall file stay off that path.
+    EmitTimingMetrics(session, session.found_cookie ? "ok" :
+        (session.close_reason.empty() ? std::string("window closed") : session.close_reason));
+}
+
+// HTTP cache directory of the profile (layout differs between CEF versions)
+std::filesystem::path HttpCacheDir() {
+    namespace fs = std::filesystem;
+    for (const char* sub : {"Cache/Cache_Data", "Default/Cache/Cache_Data"}) {
+        fs::path dir = fs::path(g_cache_path) / sub;
+        std::error_code ec;
+        if (fs::is_directory(dir, ec)) return dir;
+    }
+    return fs::path(g_cache_path) / "Cache/Cache_Data";
+}
+
+// Entry files of a simple-cache directory, not its index files
+bool IsCacheEntryFile(const std::filesystem::directory_entry& entry) {
+    std::error_code ec;
+    if (!entry.is_regular_file(ec)) return false;
+    std::string name = entry.path().filename().string();
+    return name.size() > 2 && name.compare(0, 5, "index") != 0 && name.find('_') != std::string::npos;
+}
+
+CacheStats CollectCacheStats(const std::filesystem::path& dir) {
+    namespace fs = std::filesystem;
+    CacheStats stats;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!IsCacheEntryFile(*it)) continue;
+        stats.entries++;
+        stats.bytes += static_cast<int64_t>(it->file_size(ec));
+    }
+    return stats;
+}
+
+// Exit report: what the HTTP cache holds against its cap, and how many
+// entries the run added. CEF has no per-request hit flag, so no hit rate.
+void ReportCacheStats() {
+    if (g_cache_size_mb <= 0) return;
+    CacheStats now = CollectCacheStats(HttpCacheDir());
+    std::cerr << "Cache: " << now.entries << " entries (" << now.entries - g_cache_at_start.entries
+              << " added this run), " << now.bytes / (1024 * 1024) << "/" << g_cache_size_mb
+              << " MiB" << std::endl;
+}
+
+int GpuProfileFromName(const std::string& name) {
+    for (int p = 0; p < GPU_PROFILE_COUNT; p++) {
+        if (name == kGpuProfileNames[p]) return p;
+    }
+    return -1;
+}
+
+GpuProfileState ReadGpuState() {
+    GpuProfileState state;
+    std::ifstream in(g_gpu_state_file);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = line.substr(0, eq);
+        std::string value = line.substr(eq + 1);
+        auto dot = key.find('.');
+        int profile = dot == std::string::npos ? -1 : GpuProfileFromName(key.substr(dot + 1));
+        try {
+            if (key == "pending") {
+                state.pending = value;
+            } else if (profile >= 0 && key.compare(0, dot, "failures") == 0) {
+                state.failures[profile] = std::stoi(value);
+            } else if (profile >= 0 && key.compare(0, dot, "startup_ms") == 0) {
+                state.startup_ms[profile] = std::stoll(value);
+            }
+        } catch (const std::exception&) {
+            // Corrupt entry: keep the default
+        }
+    }
+    return state;
+}
+
+void WriteGpuState(const GpuProfileState& state) {
+    std::ofstream out(g_gpu_state_file, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Cannot write " << g_gpu_state_file << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    out << "pending=" << state.pending << "\n";
+    for (int p = 0; p < GPU_PROFILE_COUNT; p++) {
+        out << "failures." << kGpuProfileNames[p] << "=" << state.failures[p] << "\n";
+        out << "startup_ms." << kGpuProfileNames[p] << "=" << state.startup_ms[p] << "\n";
+    }
+}
+
+// Pick the rendering profile for this run and mark it pending. Runs in main()
+// before CefInitialize, i.e. before OnBeforeCommandLineProcessing.
+void SelectGpuProfile() {
+    GpuProfileState state = ReadGpuState();
+    int unconfirmed = GpuProfileFromName(state.pending);
+    if (unconfirmed >= 0) {
+        state.failures[unconfirmed]++;
+        std::cerr << "Previous run with the " << state.pending
+                  << " rendering profile never presented a frame (failure "
+                  << state.failures[unconfirmed] << "/" << kMaxGpuFailures << ")" << std::endl;
+    }
+
+    int requested = GpuProfileFromName(g_gpu_profile_request);
+    if (requested >= 0) {
+        g_gpu_profile = requested;
+    } else {
+        g_gpu_profile = GPU_PROFILE_SOFTWARE;
+        for (int p = 0; p < GPU_PROFILE_COUNT; p++) {
+            if (state.failures[p] < kMaxGpuFailures) {
+                g_gpu_profile = p;
+                break;
+            }
+        }
+    }
+    std::cerr << "Rendering profile: " << kGpuProfileNames[g_gpu_profile];
+    if (state.startup_ms[g_gpu_profile] > 0) {
+        std::cerr << " (last startup " << state.startup_ms[g_gpu_profile] << " ms)";
+    }
+    std::cerr << std::endl;
+
+    state.pending = kGpuProfileNames[g_gpu_profile];
+    WriteGpuState(state);
+
+    std::random_device rd;
+    char nonce[17];
+    snprintf(nonce, sizeof(nonce), "%08x%08x", rd(), rd());
+    g_frame_marker = std::string("pulse-auth-first-frame:") + nonce;
+}
+
+// Conclusive failure of this run's profile: mark it failed outright so the
+// next run falls back to the next profile. Called from WatchGpuProcess on the
+// file thread and from ReleaseGpuProfile.
+void FailGpuProfile(const char* reason) {
+    std::lock_guard<std::mutex> lock(g_gpu_state_mutex);
+    GpuProfileState state = ReadGpuState();
+    state.pending.clear();
+    state.failures[g_gpu_profile] = kMaxGpuFailures;
+    WriteGpuState(state);
+    std::cerr << "The " << kGpuProfileNames[g_gpu_profile] << " rendering profile failed (" << reason << ")";
+    if (g_gpu_profile + 1 < GPU_PROFILE_COUNT) {
+        std::cerr << "; the next run uses " << kGpuProfileNames[g_gpu_profile + 1];
+    }
+    std::cerr << std::endl;
+}
+
+// Run ended without a presented frame. A GPU process crash has already been
+// recorded by the watcher. A page that loaded and still had no frame out
+// kGpuFrameGraceMs later is a blank window: failed outright. Otherwise it is only a failure if a browser
+// was opened and no network error explains it; an idle daemon that never
+// served a request, or an unreachable gateway, says nothing about the profile.
+void ReleaseGpuProfile() {
+    g_gpu_watch_stopped = true;
+    if (g_gpu_crashes > 0 || g_gpu_profile_confirmed) return;
+    if (g_gpu_page_loaded && std::chrono::steady_clock::now() - g_gpu_first_load >
+                                 std::chrono::milliseconds(kGpuFrameGraceMs)) {
+        FailGpuProfile("pages loaded but no frame was presented");
+        return;
+    }
+    if (g_gpu_profile_exercised && !g_gpu_load_error_seen) return;
+    std::lock_guard<std::mutex> lock(g_gpu_state_mutex);
+    GpuProfileState state = ReadGpuState();
+    state.pending.clear();
+    WriteGpuState(state);
+}
+
+// First frame presented: the profile works on this machine, unless the GPU
+// process has already crashed on the way there
+void ConfirmGpuProfile() {
+    CEF_REQUIRE_UI_THREAD();
+    if (g_gpu_profile_confirmed || g_gpu_crashes > 0) return;
+    g_gpu_profile_confirmed = true;
+    std::lock_guard<std::mutex> lock(g_gpu_state_mutex);
+    GpuProfileState state = ReadGpuState();
+    state.pending.clear();
+    state.failures[g_gpu_profile] = 0;
+    state.startup_ms[g_gpu_profile] = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - g_process_start).count();
+    WriteGpuState(state);
+}
+
+// Task to hand a DSID seen on another thread (IO, cookie visitor) to the UI thread
+class DSIDFoundTask : public CefTask {
+public:
+    DSIDFoundTask(std::shared_ptr<AuthSession> session, std::string host, std::string value,
+                  int status, const char* source)
+        : session_(std::move(session)), host_(std::move(host)), value_(std::move(value)),
+          status_(status), source_(source) {}
+    void Execute() override {
+        if (session_->ended) return;
+        int gateway = session_->GatewayForHost(host_);
+        if (gateway >= 0) RecordDSIDCandidate(session_, gateway, value_, status_, source_);
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    std::string host_;
+    std::string value_;
+    int status_;
+    const char* source_;
+    IMPLEMENT_REFCOUNTING(DSIDFoundTask);
+};
+
+// Cookie access filter: sees every Set-Cookie the network stack is about to
+// store, on the IO thread, as soon as the response headers arrive. This is how
+// the DSID is normally detected - no cookie-store polling required.
+class DSIDCookieAccessFilter : public CefCookieAccessFilter {
+public:
+    explicit DSIDCookieAccessFilter(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+
+    bool CanSaveCookie(CefRefPtr<CefBrowser> browser,
+                       CefRefPtr<CefFrame> frame,
+                       CefRefPtr<CefRequest> request,
+                       CefRefPtr<CefResponse> response,
+                       const CefCookie& cookie) override {
+        if (CefString(&cookie.name).ToString() == "DSID") {
+            std::string host = HostFromUrl(request->GetURL().ToString());
+            if (session_->IsGatewayHost(host)) {
+                CefPostTask(TID_UI, new DSIDFoundTask(session_, host, CefString(&cookie.value).ToString(),
+                                                      response->GetStatus(), "set-cookie"));
+            }
+        }
+        // Always let the cookie through; we only observe it
+        return true;
+    }
+
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(DSIDCookieAccessFilter);
+};
+
+struct ExtensionSkipEntry {
+    std::string host;
+    int runs_without_form;  // Consecutive finished sign-ins without a password field
+    time_t updated;
+};
+
+// Unexpired skip-list entries
+std::vector<ExtensionSkipEntry> ReadExtensionSkipHosts() {
+    std::vector<ExtensionSkipEntry> hosts;
+    time_t cutoff = time(nullptr) - static_cast<time_t>(kExtensionHostMaxAgeDays) * 24 * 3600;
+    std::ifstream in(g_extension_skip_file);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        ExtensionSkipEntry entry;
+        long long updated = 0;
+        if (!(fields >> entry.host >> entry.runs_without_form >> updated)) continue;
+        entry.updated = static_cast<time_t>(updated);
+        if (entry.updated >= cutoff) hosts.push_back(entry);
+    }
+    return hosts;
+}
+
+// Count a finished sign-in of host with or without a password field and
+// rewrite the file; false if it can't be written
+bool UpdateExtensionSkipHost(const std::string& host, bool credential_form) {
+    std::vector<ExtensionSkipEntry> hosts;
+    int runs = 0;
+    for (const auto& entry : ReadExtensionSkipHosts()) {
+        if (entry.host == host) {
+            runs = entry.runs_without_form;
+        } else {
+            hosts.push_back(entry);
+        }
+    }
+    if (!credential_form) hosts.push_back({host, runs + 1, time(nullptr)});
+    std::stable_sort(hosts.begin(), hosts.end(),
+                     [](const auto& a, const auto& b) { return a.updated > b.updated; });
+    if (hosts.size() > kMaxExtensionHosts) hosts.resize(kMaxExtensionHosts);
+    std::ofstream out(g_extension_skip_file, std::ios::trunc);
+    for (const auto& entry : hosts) {
+        out << entry.host << ' ' << entry.runs_without_form << ' ' << static_cast<long long>(entry.updated) << '\n';
+    }
+    out.close();
+    return static_cast<bool>(out);
+}
+
+// Decide before CefInitialize whether this run passes --load-extension: yes
+// unless every gateway is on the skip list
+void SelectExtensionLoading(const AuthSession& session) {
+    if (g_extension_path.empty()) return;
+    g_extension_loaded = true;
+    if (g_eager_extension || g_daemon_mode) return;
+    std::vector<ExtensionSkipEntry> known = ReadExtensionSkipHosts();
+    for (const auto& gw : session.gateways) {
+        auto it = std::find_if(known.begin(), known.end(), [&](const ExtensionSkipEntry& entry) {
+            return entry.host == gw.host && entry.runs_without_form >= kNoFormRunsToSkip;
+        });
+        if (it == known.end()) return;
+    }
+    g_extension_loaded = false;
+    std::cerr << "Extension skipped: the IdP has not shown a password form in the last "
+              << kNoFormRunsToSkip << " sign-ins" << std::endl;
+}
+
+// Whether finished sign-ins are counted for the skip list this run
+bool TrackingCredentialForms() {
+    return !g_extension_path.empty() && !g_eager_extension && !g_daemon_mode;
+}
+
+// Injected at load end into IdP pages while credential forms are tracked.
+// Okta-style sign-in pages render the password field after load, so the
+// page is checked once more a little later rather than observed.
+std::string CredentialFormProbe() {
+    return "(function () {"
+           "  function check() {"
+           "    var found = !!document.querySelector('input[type=password]');"
+           "    if (found) console.log('" + std::string(kCredentialFormMarker) + "');"
+           "    return found;"
+           "  }"
+           "  if (!check()) setTimeout(check, 1500);"
+           "})();";
+}
+
+// Injected into the first loaded page of a windowed browser, which has no
+// paint callback. The second animation frame callback runs only after the
+// compositor has produced the first one, so it does not fire while the GPU
+// process is stuck or the window stays blank.
+std::string FirstFrameProbe() {
+    return "requestAnimationFrame(function () {"
+           "  requestAnimationFrame(function () { console.log('" + g_frame_marker + "'); });"
+           "});";
+}
+
+// A password field on the gateway's IdP pages: take the host off the skip
+// list now, so a run killed after its DSID still records it
+void RecordCredentialForm(GatewayAuth& gw) {
+    CEF_REQUIRE_UI_THREAD();
+    if (gw.credential_form_seen) return;
+    gw.credential_form_seen = true;
+    if (!UpdateExtensionSkipHost(gw.host, true)) {
+        std::cerr << "Failed to write " << g_extension_skip_file << std::endl;
+        return;
+    }
+    if (!g_extension_loaded) {
+        std::cerr << "Credential form on the " << gw.host
+                  << " sign-in flow, loading the extension again from its next sign-in" << std::endl;
+    }
+}
+
+// Gateway signed in: one more run without a password field, if it had none
+void RecordSignInWithoutForm(const GatewayAuth& gw) {
+    if (!TrackingCredentialForms() || gw.credential_form_seen) return;
+    if (!UpdateExtensionSkipHost(gw.host, false)) {
+        std::cerr << "Failed to write " << g_extension_skip_file << std::endl;
+    }
+}
+
+// Directory libcef.so was mapped from, which is where its paks live too
+std::string CefLibraryDir() {
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        size_t path = line.find('/');
+        if (path == std::string::npos) continue;
+        std::string file = line.substr(path);
+        if (file.size() > 10 && file.compare(file.size() - 10, 10, "/libcef.so") == 0) {
+            return file.substr(0, file.size() - 10);
+        }
+    }
+    return "";
+}
+
+// Ask the kernel to start reading the bundle files listed in readahead.list
+// (written by the build in load order) while we are still parsing flags and
+// pruning caches, so CefInitialize finds them in the page cache after a cold
+// boot. Best effort: a missing list or file just means no readahead.
+void StartBundleReadahead() {
+    std::string dir = CefLibraryDir();
+    if (dir.empty()) return;
+    std::ifstream list(dir + "/readahead.list");
+    std::vector<std::string> files;
+    std::string file;
+    while (std::getline(list, file)) {
+        if (!file.empty()) files.push_back(dir + "/" + file);
+    }
+    if (files.empty()) return;
+    std::thread([files]() {
+        for (const auto& path : files) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            close(fd);
+        }
+    }).detach();
+}
+
+#ifdef PULSE_AUTH_BUNDLE_LOCALE
+// "de_DE.UTF-8" -> "de-DE,de", so pinning the UI locale to the one pak the
+// pruned bundle ships doesn't also change what the IdP is asked to render
+std::string AcceptLanguageFromEnv() {
+    const char* lang = getenv("LC_ALL");
+    if (!lang || !*lang) lang = getenv("LC_MESSAGES");
+    if (!lang || !*lang) lang = getenv("LANG");
+    if (!lang || !*lang) return "";
+    std::string tag(lang);
+    tag = tag.substr(0, tag.find_first_of(".@"));
+    if (tag.empty() || tag == "C" || tag == "POSIX") return "";
+    std::replace(tag.begin(), tag.end(), '_', '-');
+    size_t dash = tag.find('-');
+    if (dash == std::string::npos) return tag;
+    return tag + "," + tag.substr(0, dash);
+}
+#endif
+
+bool IsIpLiteral(const std::string& host) {
+    unsigned char buf[sizeof(in6_addr)];
+    return inet_pton(AF_INET, host.c_str(), buf) == 1 || inet_pton(AF_INET6, host.c_str(), buf) == 1;
+}
+
+// "<gateway-host> <host>" lines, in first-navigation order per gateway
+std::vector<std::pair<std::string, std::string>> ReadResolveHosts() {
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::ifstream in(g_resolve_hosts_file);
+    std::string gateway, host;
+    while (in >> gateway >> host) entries.push_back({gateway, host});
+    return entries;
+}
+
+// Counts the warm-up lookups and logs once all of them have answered
+class PreResolveCallback : public CefResolveCallback {
+public:
+    PreResolveCallback(std::shared_ptr<AuthSession> session, size_t total)
+        : session_(std::move(session)), total_(total), pending_(total) {}
+    void OnResolveCompleted(cef_errorcode_t result, const std::vector<CefString>& resolved_ips) override {
+        CEF_REQUIRE_UI_THREAD();
+        if (result == ERR_NONE && !resolved_ips.empty()) resolved_++;
+        if (--pending_ > 0) return;
+        std::cerr << "Pre-resolved " << resolved_ << "/" << total_ << " hosts, done at "
+                  << session_->ElapsedMs() << " ms" << std::endl;
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    size_t total_;
+    size_t pending_;
+    size_t resolved_ = 0;
+    IMPLEMENT_REFCOUNTING(PreResolveCallback);
+};
+
+// Warm Chromium's host cache for this session's gateways and the hosts their
+// last flow went through; returns without waiting (UI thread)
+void StartPreResolve(const std::shared_ptr<AuthSession>& session) {
+    CEF_REQUIRE_UI_THREAD();
+    std::vector<std::string> hosts;
+    auto add = [&hosts](const std::string& host) {
+        if (host.empty() || host == "localhost" || IsIpLiteral(host)) return;
+        for (const auto& mapped : g_resolve_overrides) {
+            if (mapped.first == host) return;
+        }
+        if (std::find(hosts.begin(), hosts.end(), host) == hosts.end()) hosts.push_back(host);
+    };
+    for (const auto& host : session->hosts) add(host);
+    for (const auto& entry : ReadResolveHosts()) {
+        if (session->IsGatewayHost(entry.first)) add(entry.second);
+    }
+    CefRefPtr<CefRequestContext> context = CefRequestContext::GetGlobalContext();
+    if (hosts.empty() || !context) return;
+
+    CefRefPtr<PreResolveCallback> callback = new PreResolveCallback(session, hosts.size());
+    for (const auto& host : hosts) {
+        context->ResolveHost("https://" + host, callback);
+    }
+}
+
+// Remember the completed gateways' navigation hosts for the next run,
+// keeping the entries of gateways this run didn't authenticate
+void SaveNavigatedHosts(const AuthSession& session) {
+    if (g_daemon_mode || g_resolve_hosts_file.empty()) return;
+    std::vector<std::pair<std::string, std::string>> entries;
+    for (const auto& entry : ReadResolveHosts()) {
+        bool replaced = false;
+        for (const auto& gw : session.gateways) {
+            if (gw.found && gw.host == entry.first) replaced = true;
+        }
+        if (!replaced) entries.push_back(entry);
+    }
+    for (const auto& gw : session.gateways) {
+        if (!gw.found) continue;
+        size_t kept = 0;
+        for (const auto& host : gw.navigated_hosts) {
+            if (host == gw.host || session.IsGatewayHost(host) || IsIpLiteral(host)) continue;
+            if (kept++ == kMaxResolveHostsPerGateway) break;
+            entries.push_back({gw.host, host});
+        }
+    }
+    std::ofstream out(g_resolve_hosts_file, std::ios::trunc);
+    for (const auto& entry : entries) out << entry.first << ' ' << entry.second << '\n';
+}
+
+std::vector<std::pair<std::string, std::string>> ReadEntryUrls() {
+    std::vector<std::pair<std::string, std::string>> entries;
+    std::ifstream in(g_entry_urls_file);
+    std::string host, url;
+    while (in >> host >> url) entries.push_back({host, url});
+    return entries;
+}
+
+// Start a new session's gateways at their cached entry URLs
+void SelectEntryUrls(AuthSession& session) {
+    if (!g_entry_shortcut || g_entry_urls_file.empty()) return;
+    for (const auto& entry : ReadEntryUrls()) {
+        int gateway = session.GatewayForHost(entry.first);
+        // Never off the gateway host: the DSID is only picked up there
+        if (gateway < 0 || HostFromUrl(entry.second) != entry.first) continue;
+        session.gateways[gateway].entry_url = entry.second;
+    }
+}
+
+// Replace a gateway's cached entry URL; an empty url drops it
+void StoreEntryUrl(const std::string& host, const std::string& url) {
+    if (!g_entry_shortcut || g_entry_urls_file.empty()) return;
+    std::vector<std::pair<std::string, std::string>> entries;
+    for (const auto& entry : ReadEntryUrls()) {
+        if (entry.first != host) entries.push_back(entry);
+    }
+    if (!url.empty()) entries.push_back({host, url});
+    std::ofstream out(g_entry_urls_file, std::ios::trunc);
+    for (const auto& entry : entries) out << entry.first << ' ' << entry.second << '\n';
+}
+
+std::string StartUrl(const GatewayAuth& gw) {
+    return gw.entry_url.empty() ? gw.url : gw.entry_url;
+}
+
+// The cached entry URL didn't lead to the IdP: forget it and start over at
+// the gateway URL in the same browser (UI thread)
+void FallBackToGatewayUrl(AuthSession& session, size_t gateway, const std::string& why) {
+    GatewayAuth& gw = session.gateways[gateway];
+    if (!gw.entry_pending || gw.found || session.should_close) return;
+    std::cerr << "Cached SSO entry for " << gw.host << " " << why << ", loading the gateway URL" << std::endl;
+    gw.entry_pending = false;
+    gw.entry_url.clear();
+    gw.gateway_nav_url.clear();
+    MarkPhase(session, gw, "entry_fallback");
+    StoreEntryUrl(gw.host, "");
+    if (gw.browser) gw.browser->GetMainFrame()->LoadURL(gw.url);
+}
+
+// The entry page loaded and settled on the gateway without moving on
+class EntryShortcutCheckTask : public CefTask {
+public:
+    EntryShortcutCheckTask(std::shared_ptr<AuthSession> session, size_t gateway, int browser_id)
+        : session_(std::move(session)), gateway_(gateway), browser_id_(browser_id) {}
+    void Execute() override {
+        if (session_->ended || gateway_ >= session_->gateways.size()) return;
+        const GatewayAuth& gw = session_->gateways[gateway_];
+        if (!gw.browser || gw.browser->GetIdentifier() != browser_id_) return;
+        FallBackToGatewayUrl(*session_, gateway_, "stayed on the gateway");
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    size_t gateway_;
+    int browser_id_;
+    IMPLEMENT_REFCOUNTING(EntryShortcutCheckTask);
+};
+
+// Resource request handler to modify User-Agent header per request. Runs on
+// the IO thread and only touches its own session's atomics.
 class AuthResourceRequestHandler : public CefResourceRequestHandler {
 public:
+    explicit AuthResourceRequestHandler(std::shared_ptr<AuthSession> session)
+        : session_(session), cookie_filter_(new DSIDCookieAccessFilter(session)) {}
+
+    // Legacy mode: Linux UA from the next request on (UI thread -> IO thread)
+    void SwitchToLinuxUA() { ua_switched_ = true; }
+
+    CefRefPtr<CefCookieAccessFilter> GetCookieAccessFilter(
+        CefRefPtr<CefBrowser> browser,
+        CefRefPtr<CefFrame> frame,
+        CefRefPtr<CefRequest> request) override {
+        return cookie_filter_;
+    }
+
     cef_return_value_t OnBeforeResourceLoad(
         CefRefPtr<CefBrowser> browser,
         CefRefPtr<CefFrame> frame,
         CefRefPtr<CefRequest> request,
         CefRefPtr<CefCallback> callback) override {
 
+        int type = request->GetResourceType();
+        if (ShouldBlockRequest(*session_, request->GetURL().ToString(), type)) {
+            session_->blocked_count[type]++;
+            return RV_CANCEL;
+        }
+        WaterfallStart(*session_, request->GetIdentifier(), request->GetURL().ToString(), type);
+
         // In mimic-pulse mode, CEF's own user_agent_product handles the UA
         // consistently across HTTP headers, navigator.userAgent, and Client Hints.
         // Skip per-request header rewriting to avoid introducing inconsistencies.
@@ -82,29 +1906,166 @@ public:
             headers.erase(it);
         }
 
-        // Use Windows UA for first load, Linux UA after switch
-        if (g_ua_switched) {
-            headers.insert(std::make_pair("User-Agent", g_linux_ua));
-        } else {
-            headers.insert(std::make_pair("User-Agent", g_windows_ua));
+        // Per-host rule first, else Windows UA until the first load, Linux UA after
+        bool use_linux = ua_switched_;
+        std::string host = HostFromUrl(request->GetURL().ToString());
+        for (const auto& rule : g_ua_rules) {
+            if (fnmatch(rule.host.c_str(), host.c_str(), 0) == 0) {
+                use_linux = rule.linux_ua;
+                break;
+            }
         }
+        headers.insert(std::make_pair("User-Agent", use_linux ? g_linux_ua : g_windows_ua));
 
         request->SetHeaderMap(headers);
         return RV_CONTINUE;
     }
 
+    void OnResourceRedirect(CefRefPtr<CefBrowser> browser,
+                            CefRefPtr<CefFrame> frame,
+                            CefRefPtr<CefRequest> request,
+                            CefRefPtr<CefResponse> response,
+                            CefString& new_url) override {
+        WaterfallRedirect(*session_, request->GetIdentifier(), response, new_url.ToString(),
+                          request->GetResourceType());
+    }
+
+    bool OnResourceResponse(CefRefPtr<CefBrowser> browser,
+                            CefRefPtr<CefFrame> frame,
+                            CefRefPtr<CefRequest> request,
+                            CefRefPtr<CefResponse> response) override {
+        WaterfallResponse(*session_, request->GetIdentifier(), response);
+        return false;
+    }
+
+    // Per-type transfer sizes, used to estimate what blocking saved
+    void OnResourceLoadComplete(CefRefPtr<CefBrowser> browser,
+                                CefRefPtr<CefFrame> frame,
+                                CefRefPtr<CefRequest> request,
+                                CefRefPtr<CefResponse> response,
+                                URLRequestStatus status,
+                                int64_t received_content_length) override {
+        WaterfallComplete(*session_, request->GetIdentifier(), response, status != UR_SUCCESS,
+                          received_content_length);
+        if (status != UR_SUCCESS || received_content_length <= 0) return;
+        int type = request->GetResourceType();
+        session_->loaded_count[type]++;
+        session_->loaded_bytes[type] += received_content_length;
+    }
+
 private:
+    std::shared_ptr<AuthSession> session_;
+    CefRefPtr<DSIDCookieAccessFilter> cookie_filter_;
+    std::atomic<bool> ua_switched_{false};
     IMPLEMENT_REFCOUNTING(AuthResourceRequestHandler);
 };
 
-// Client handler
+// Render handler for the hidden silent-auth browser: a fixed viewport and
+// frames that are simply dropped
+class SilentRenderHandler : public CefRenderHandler {
+public:
+    void GetViewRect(CefRefPtr<CefBrowser> browser, CefRect& rect) override {
+        rect = CefRect(0, 0, 800, 600);
+    }
+    void OnPaint(CefRefPtr<CefBrowser> browser,
+                 PaintElementType type,
+                 const RectList& dirtyRects,
+                 const void* buffer,
+                 int width,
+                 int height) override {
+        if (type == PET_VIEW && width > 0 && height > 0) ConfirmGpuProfile();
+    }
+
+private:
+    IMPLEMENT_REFCOUNTING(SilentRenderHandler);
+};
+
+class TraceWrittenCallback : public CefEndTracingCallback {
+public:
+    explicit TraceWrittenCallback(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void OnEndTracingComplete(const CefString& tracing_file) override {
+        CEF_REQUIRE_UI_THREAD();
+        session_->trace_state = TRACE_DONE;
+        std::cerr << "Trace written to " << tracing_file.ToString() << std::endl;
+        if (session_->quit_pending) QuitWhenSettled(session_);
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(TraceWrittenCallback);
+};
+
+void StartTracing(AuthSession& session) {
+    CEF_REQUIRE_UI_THREAD();
+    if (g_trace_file.empty() || session.trace_state != TRACE_OFF) return;
+    if (CefBeginTracing(kTraceCategories, nullptr)) {
+        session.trace_state = TRACE_RUNNING;
+        std::cerr << "Tracing to " << g_trace_file << std::endl;
+    } else {
+        std::cerr << "Could not start tracing" << std::endl;
+    }
+}
+
+// Stop collecting and start writing the file; once per run
+void StopTracing(const std::shared_ptr<AuthSession>& session) {
+    CEF_REQUIRE_UI_THREAD();
+    if (session->trace_state != TRACE_RUNNING) return;
+    session->trace_state = TRACE_WRITING;
+    if (!CefEndTracing(g_trace_file, new TraceWrittenCallback(session))) {
+        std::cerr << "Could not write the trace" << std::endl;
+        session->trace_state = TRACE_DONE;
+    }
+}
+
+// CefQuitMessageLoop, once the trace (if any) is on disk and the accepted
+// DSIDs are out of the cookie store. Called again by whichever finishes last.
+void QuitWhenSettled(const std::shared_ptr<AuthSession>& session) {
+    CEF_REQUIRE_UI_THREAD();
+    StopTracing(session);
+    if (session->trace_state == TRACE_WRITING || session->dsid_deletes_pending > 0) {
+        session->quit_pending = true;
+        return;
+    }
+    session->quit_pending = false;
+    CefQuitMessageLoop();
+}
+
+// Reload a gateway browser whose renderer died. Posted rather than run from
+// OnRenderProcessTerminated so the browser has finished tearing down the
+// dead process first.
+class RendererReloadTask : public CefTask {
+public:
+    RendererReloadTask(std::shared_ptr<AuthSession> session, size_t gateway)
+        : session_(std::move(session)), gateway_(gateway) {}
+    void Execute() override {
+        if (session_->ended || gateway_ >= session_->gateways.size()) return;
+        const GatewayAuth& gw = session_->gateways[gateway_];
+        if (!gw.browser || gw.found || session_->should_close) return;
+        // LoadURL rather than Reload: a crash right after the SAML POST must
+        // not re-submit the assertion
+        const std::string& url = gw.committed_url.empty() ? gw.url : gw.committed_url;
+        gw.browser->GetMainFrame()->LoadURL(url);
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    size_t gateway_;
+    IMPLEMENT_REFCOUNTING(RendererReloadTask);
+};
+
+// Client handler, one per gateway browser
 class AuthClient : public CefClient,
+                   public CefDisplayHandler,
                    public CefLifeSpanHandler,
                    public CefLoadHandler,
                    public CefRequestHandler {
 public:
-    AuthClient() : resource_handler_(new AuthResourceRequestHandler()) {}
+    AuthClient(std::shared_ptr<AuthSession> session, size_t gateway, bool windowless = false)
+        : session_(session), gateway_(gateway),
+          resource_handler_(new AuthResourceRequestHandler(session)),
+          render_handler_(windowless ? new SilentRenderHandler() : nullptr) {}
+
+    CefRefPtr<CefRenderHandler> GetRenderHandler() override { return render_handler_; }
 
+    CefRefPtr<CefDisplayHandler> GetDisplayHandler() override { return this; }
     CefRefPtr<CefLifeSpanHandler> GetLifeSpanHandler() override { return this; }
     CefRefPtr<CefLoadHandler> GetLoadHandler() override { return this; }
     CefRefPtr<CefRequestHandler> GetRequestHandler() override { return this; }
@@ -121,17 +2082,59 @@ public:
         return resource_handler_;
     }
 
+    // CefRequestHandler - --trust-spki, for the gateway hosts only. Chromium
+    // remembers the decision for the host, so the page's own subresources
+    // from the gateway are let through as well.
+    bool OnCertificateError(CefRefPtr<CefBrowser> browser,
+                            cef_errorcode_t cert_error,
+                            const CefString& request_url,
+                            CefRefPtr<CefSSLInfo> ssl_info,
+                            CefRefPtr<CefCallback> callback) override {
+        CEF_REQUIRE_UI_THREAD();
+        if (!session_->IsGatewayHost(HostFromUrl(request_url.ToString())) || !TrustedSpki(ssl_info)) {
+            return false;
+        }
+        callback->Continue();
+        return true;
+    }
+
     // CefLifeSpanHandler
     void OnAfterCreated(CefRefPtr<CefBrowser> browser) override {
         CEF_REQUIRE_UI_THREAD();
-        if (!g_browser) {
-            g_browser = browser;
-            // End startup grace period after 5 seconds to allow user-initiated tabs
-            CefPostDelayedTask(TID_UI, new EndGracePeriodTask(), 5000);
-        } else if (g_startup_grace_period) {
-            // Close tabs opened by extensions during startup (e.g., 1Password welcome page)
-            browser->GetHost()->CloseBrowser(true);
+        GatewayAuth* gw = Gateway();
+        if (gw && gw->creating && !gw->browser) {
+            gw->creating = false;
+            gw->browser = browser;
+            // The DSID may have landed while this window was still being created
+            // (silent-to-visible hand-over)
+            if (gw->found || session_->should_close) {
+                browser->GetHost()->CloseBrowser(true);
+            }
+        }
+        // Any other browser was opened by an extension: page popups never get
+        // this far (OnBeforePopup). Its first navigation decides whether it
+        // stays, see OnBeforeBrowse.
+    }
+
+    // CefDisplayHandler - the credential form and first-frame probes report
+    // through the console
+    bool OnConsoleMessage(CefRefPtr<CefBrowser> browser,
+                          cef_log_severity_t level,
+                          const CefString& message,
+                          const CefString& source,
+                          int line) override {
+        CEF_REQUIRE_UI_THREAD();
+        if (!g_frame_marker.empty() && message.ToString() == g_frame_marker) {
+            ConfirmGpuProfile();
+            return true;
         }
+        GatewayAuth* gw = Gateway();
+        if (gw && TrackingCredentialForms() && IsGatewayBrowser(browser) &&
+            message.ToString() == kCredentialFormMarker) {
+            RecordCredentialForm(*gw);
+            return true;
+        }
+        return false;
     }
 
     // Block all popups and new tabs
@@ -154,11 +2157,110 @@ public:
 
     void OnBeforeClose(CefRefPtr<CefBrowser> browser) override {
         CEF_REQUIRE_UI_THREAD();
-        // Only quit when the main browser (VPN auth tab) is closing,
-        // not when extension startup tabs are closed during grace period
-        if (g_browser && browser->GetIdentifier() == g_browser->GetIdentifier()) {
-            g_browser = nullptr;
-            CefQuitMessageLoop();
+        // Only quit when the gateway browsers (VPN auth tabs) are all closed,
+        // not when extension-opened tabs are closed
+        GatewayAuth* gw = Gateway();
+        if (gw && gw->browser && browser->GetIdentifier() == gw->browser->GetIdentifier()) {
+            gw->browser = nullptr;
+            if (!AllBrowsersClosed(*session_)) return;
+            if (g_daemon_mode) {
+                // Keep the CEF context alive for the next request
+                EndDaemonSession(*session_);
+                if (g_daemon_stopping) QuitWhenSettled(session_);
+            } else {
+                QuitWhenSettled(session_);
+            }
+        }
+    }
+
+    // CefRequestHandler - renderer crash recovery
+    void OnRenderProcessTerminated(CefRefPtr<CefBrowser> browser,
+                                   TerminationStatus status,
+                                   int error_code,
+                                   const CefString& error_string) override {
+        CEF_REQUIRE_UI_THREAD();
+        GatewayAuth* gw = Gateway();
+        if (!gw || !IsGatewayBrowser(browser) || gw->found || session_->should_close) return;
+        gw->renderer_crashes++;
+        std::cerr << "Renderer terminated (status " << status << ", code " << error_code << ")";
+        if (session_->gateways.size() > 1) std::cerr << " for " << gw->host;
+        if (gw->renderer_crashes > g_max_renderer_reloads) {
+            std::cerr << "; " << gw->renderer_crashes - 1 << " reloads already spent, giving up" << std::endl;
+            session_->should_close = true;
+            session_->close_reason = "renderer crashed";
+            CloseAllBrowsers(*session_);
+            return;
+        }
+        std::cerr << ", reloading (" << gw->renderer_crashes << "/" << g_max_renderer_reloads << ")" << std::endl;
+        CefPostTask(TID_UI, new RendererReloadTask(session_, gateway_));
+    }
+
+    // CefRequestHandler - main-frame navigation timing
+    bool OnBeforeBrowse(CefRefPtr<CefBrowser> browser,
+                        CefRefPtr<CefFrame> frame,
+                        CefRefPtr<CefRequest> request,
+                        bool user_gesture,
+                        bool is_redirect) override {
+        CEF_REQUIRE_UI_THREAD();
+        if (frame->IsMain() && !IsGatewayBrowser(browser)) {
+            // Extension-opened tab: keep the extension's own UI (e.g. an
+            // unlock window), close onboarding/welcome pages on the web
+            std::string url = request->GetURL().ToString();
+            if (url.rfind("chrome-extension://", 0) == 0) return false;
+            std::cerr << "Closing extension-opened tab (" << HostFromUrl(url) << ")" << std::endl;
+            browser->GetHost()->CloseBrowser(true);
+            return true;
+        }
+        GatewayAuth* gw = Gateway();
+        if (!frame->IsMain() || !gw) return false;
+        session_->navigation_count++;
+        std::string nav_host = HostFromUrl(request->GetURL().ToString());
+        std::vector<std::string>& navigated = gw->navigated_hosts;
+        if (std::find(navigated.begin(), navigated.end(), nav_host) == navigated.end()) {
+            navigated.push_back(nav_host);
+        }
+        if (is_redirect) session_->redirect_count++;
+        bool to_gateway = HostFromUrl(request->GetURL().ToString()) == gw->host;
+        if (to_gateway && gw->sso_entry_url.empty()) {
+            gw->gateway_nav_url = request->GetURL().ToString();
+        } else if (!to_gateway) {
+            // First hop to the IdP: the gateway URL before it is the realm's SSO entry
+            if (gw->sso_entry_url.empty()) gw->sso_entry_url = gw->gateway_nav_url;
+            gw->entry_pending = false;
+        }
+        if (!to_gateway) {
+            MarkPhase(*session_, *gw, "idp_redirect");
+        } else if (request->GetMethod().ToString() == "POST" && HasPhase(gw->phase_marks, "idp_redirect")) {
+            MarkPhase(*session_, *gw, "saml_post");
+            // The IdP has set its session cookies by the time it posts the
+            // assertion back: the other gateways can now sign in silently
+            if (gateway_ == 0) StartRemainingGateways(session_);
+        }
+        return false;
+    }
+
+    // CefLoadHandler
+    void OnLoadStart(CefRefPtr<CefBrowser> browser,
+                     CefRefPtr<CefFrame> frame,
+                     TransitionType transition_type) override {
+        GatewayAuth* gw = Gateway();
+        if (frame->IsMain() && gw && IsGatewayBrowser(browser)) {
+            gw->committed_url = frame->GetURL().ToString();
+        }
+        if (frame->IsMain() && gw && HostFromUrl(frame->GetURL().ToString()) == gw->host) {
+            MarkPhase(*session_, *gw, "gateway_load_start");
+        }
+    }
+
+    void OnLoadError(CefRefPtr<CefBrowser> browser,
+                     CefRefPtr<CefFrame> frame,
+                     ErrorCode errorCode,
+                     const CefString& errorText,
+                     const CefString& failedUrl) override {
+        if (frame->IsMain()) g_gpu_load_error_seen = true;
+        GatewayAuth* gw = Gateway();
+        if (frame->IsMain() && gw && gw->entry_pending && errorCode != ERR_ABORTED && IsGatewayBrowser(browser)) {
+            FallBackToGatewayUrl(*session_, gateway_, "failed to load (" + errorText.ToString() + ")");
         }
     }
 
@@ -166,110 +2268,857 @@ public:
     void OnLoadEnd(CefRefPtr<CefBrowser> browser,
                    CefRefPtr<CefFrame> frame,
                    int httpStatusCode) override {
-        if (frame->IsMain() && !g_found_cookie) {
+        if (frame->IsMain()) {
+            if (!g_gpu_page_loaded) g_gpu_first_load = std::chrono::steady_clock::now();
+            g_gpu_page_loaded = true;
+            if (!g_gpu_profile_confirmed) frame->ExecuteJavaScript(FirstFrameProbe(), frame->GetURL(), 0);
+        }
+        GatewayAuth* gw = Gateway();
+        if (frame->IsMain() && gw) CaptureGatewayCert(*gw, browser);
+        if (frame->IsMain() && gw && gw->entry_pending && IsGatewayBrowser(browser) &&
+            HostFromUrl(frame->GetURL().ToString()) == gw->host) {
+            if (httpStatusCode >= 400) {
+                FallBackToGatewayUrl(*session_, gateway_, "answered HTTP " + std::to_string(httpStatusCode));
+                return;
+            }
+            if (frame->GetURL().ToString() != gw->entry_url) {
+                FallBackToGatewayUrl(*session_, gateway_, "led to another gateway page");
+                return;
+            }
+            CefPostDelayedTask(TID_UI, new EntryShortcutCheckTask(session_, gateway_, browser->GetIdentifier()),
+                               kEntryShortcutGraceMs);
+        }
+        if (frame->IsMain() && gw && !gw->found && !gw->credential_form_seen && TrackingCredentialForms() &&
+            HostFromUrl(frame->GetURL().ToString()) != gw->host) {
+            frame->ExecuteJavaScript(CredentialFormProbe(), frame->GetURL(), 0);
+        }
+        if (frame->IsMain() && gw && !gw->found) {
             if (g_mimic_pulse) {
                 // No UA switching in mimic mode — check for DSID cookie on every load
-                CheckAndCloseBrowser();
-            } else if (!g_first_load_complete) {
-                // First load complete with Windows UA - now switch to Linux UA and reload
+                ScanCookieStore(session_, gateway_);
+            } else if (!first_load_complete_) {
+                // First load complete with Windows UA - switch to Linux UA
                 // This bypasses Okta's initial Linux blocking while ensuring proper behavior after
-                g_first_load_complete = true;
-                g_ua_switched = true;
-                std::cerr << "Switching to Linux user agent and reloading..." << std::endl;
-                browser->Reload();
+                first_load_complete_ = true;
+                resource_handler_->SwitchToLinuxUA();
+                MarkPhase(*session_, *gw, "ua_switch");
+                if (g_ua_reload) {
+                    std::cerr << "Switching to Linux user agent and reloading..." << std::endl;
+                    browser->Reload();
+                } else {
+                    // Takes effect on the next navigation; no second load of this page
+                    std::cerr << "Switching to Linux user agent for further navigations" << std::endl;
+                    ScanCookieStore(session_, gateway_);
+                }
             } else {
                 // Subsequent loads - check for DSID cookie
-                CheckAndCloseBrowser();
+                ScanCookieStore(session_, gateway_);
             }
         }
     }
 
 private:
+    bool IsGatewayBrowser(CefRefPtr<CefBrowser> browser) const {
+        for (const auto& gw : session_->gateways) {
+            if (gw.browser && gw.browser->GetIdentifier() == browser->GetIdentifier()) return true;
+        }
+        return false;
+    }
+
+    // This browser's gateway; null once its auth session is over (daemon)
+    GatewayAuth* Gateway() {
+        if (session_->ended || gateway_ >= session_->gateways.size()) return nullptr;
+        return &session_->gateways[gateway_];
+    }
+
+    std::shared_ptr<AuthSession> session_;
+    size_t gateway_;
+    bool first_load_complete_ = false;
     CefRefPtr<AuthResourceRequestHandler> resource_handler_;
+    CefRefPtr<SilentRenderHandler> render_handler_;
     IMPLEMENT_REFCOUNTING(AuthClient);
 };
 
-CefRefPtr<AuthClient> g_client;
-
-// Task to close the browser
+// Task to close a gateway's browser
 class CloseBrowserTask : public CefTask {
 public:
+    CloseBrowserTask(std::shared_ptr<AuthSession> session, size_t gateway)
+        : session_(std::move(session)), gateway_(gateway) {}
     void Execute() override {
-        if (g_browser) {
-            g_browser->GetHost()->CloseBrowser(true);
+        if (session_->ended || gateway_ >= session_->gateways.size()) return;
+        if (session_->gateways[gateway_].browser) {
+            session_->gateways[gateway_].browser->GetHost()->CloseBrowser(true);
         }
     }
 private:
+    std::shared_ptr<AuthSession> session_;
+    size_t gateway_;
     IMPLEMENT_REFCOUNTING(CloseBrowserTask);
 };
 
-// Cookie visitor to find DSID
+// Record a gateway's DSID and close its browser - OnBeforeClose quits the
+// message loop once every gateway browser is gone. Runs on the UI thread; the
+// first accepted value per gateway wins.
+// The DSID is handed over on stdout and never needed from the store again.
+// With persist_session_cookies on (--persist-cookies) it would otherwise be
+// written to the profile's cookie DB, so it is deleted as soon as it is
+// accepted and the quit waits for the delete.
+class ForgetDSIDCallback : public CefDeleteCookiesCallback {
+public:
+    explicit ForgetDSIDCallback(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void OnComplete(int num_deleted) override {
+        CEF_REQUIRE_UI_THREAD();
+        session_->dsid_deletes_pending--;
+        if (session_->quit_pending) QuitWhenSettled(session_);
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(ForgetDSIDCallback);
+};
+
+void ForgetDSID(const std::shared_ptr<AuthSession>& session, const GatewayAuth& gw) {
+    CefRefPtr<CefCookieManager> manager = CefCookieManager::GetGlobalManager(nullptr);
+    session->dsid_deletes_pending++;
+    if (!manager || !manager->DeleteCookies(gw.url, "DSID", new ForgetDSIDCallback(session))) {
+        std::cerr << "Could not delete the DSID cookie of " << gw.host << std::endl;
+        session->dsid_deletes_pending--;
+    }
+}
+
+void AcceptDSID(const std::shared_ptr<AuthSession>& session, size_t gateway, const std::string& value) {
+    CEF_REQUIRE_UI_THREAD();
+    GatewayAuth& gw = session->gateways[gateway];
+    if (gw.found || session->should_close) return;
+    gw.dsid = value;
+    gw.found = true;
+    MarkPhase(*session, gw, "dsid_committed");
+    session->found_cookie = std::all_of(session->gateways.begin(), session->gateways.end(),
+                                        [](const GatewayAuth& g) { return g.found; });
+    if (session->found_cookie) {
+        EmitResult(*session);
+        StopTracing(session);
+    } else {
+        std::cerr << "DSID for " << gw.host << " committed, waiting for the other gateways" << std::endl;
+        // No assertion POST seen (e.g. a live gateway session): open them now
+        StartRemainingGateways(session);
+    }
+    ForgetDSID(session, gw);
+    RecordSignInWithoutForm(gw);
+    // Nothing to skip if the flow left straight from the gateway URL
+    StoreEntryUrl(gw.host, gw.sso_entry_url == gw.url ? std::string() : gw.sso_entry_url);
+    CefPostTask(TID_UI, new CloseBrowserTask(session, gateway));
+}
+
+// Pulse clears the cookie with an empty value or "DELETED"
+bool LooksLikeClearCookie(std::string value) {
+    value.erase(std::remove(value.begin(), value.end(), '"'), value.end());
+    for (auto& c : value) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return value.empty() || value == "deleted" || value == "null" || value == "0";
+}
+
+// A committable DSID: not a clear/placeholder cookie, long enough to be a real
+// session token, and not set by a server-error (5xx) response
+bool LooksLikeRealDSID(const std::string& value, int status) {
+    if (LooksLikeClearCookie(value)) return false;
+    std::string bare = value;
+    bare.erase(std::remove(bare.begin(), bare.end(), '"'), bare.end());
+    if (bare.size() < g_min_dsid_len) return false;
+    return status < 500;
+}
+
+// Commit the latest committable candidate if nothing newer arrived meanwhile
+class QuiesceTask : public CefTask {
+public:
+    QuiesceTask(std::shared_ptr<AuthSession> session, size_t gateway)
+        : session_(std::move(session)), gateway_(gateway),
+          generation_(session_->gateways[gateway].generation) {}
+    void Execute() override {
+        if (session_->ended) return;
+        const GatewayAuth& gw = session_->gateways[gateway_];
+        if (generation_ != gw.generation) return;
+        for (auto it = gw.candidates.rbegin(); it != gw.candidates.rend(); ++it) {
+            if (it->committable) {
+                std::cerr << "DSID quiesced for " << g_quiesce_seconds << "s, committing" << std::endl;
+                AcceptDSID(session_, gateway_, it->value);
+                return;
+            }
+        }
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    size_t gateway_;
+    int generation_;
+    IMPLEMENT_REFCOUNTING(QuiesceTask);
+};
+
+void RecordDSIDCandidate(const std::shared_ptr<AuthSession>& session, size_t gateway,
+                         const std::string& value, int status, const char* source) {
+    CEF_REQUIRE_UI_THREAD();
+    GatewayAuth& gw = session->gateways[gateway];
+    if (gw.found || session->should_close) return;
+    // The load-end cookie-store scan keeps re-reporting the current value
+    if (!gw.candidates.empty() && gw.candidates.back().value == value) return;
+
+    MarkPhase(*session, gw, "dsid_first_seen");
+    bool committable = LooksLikeRealDSID(value, status);
+    gw.candidates.push_back({value, status, source, session->ElapsedMs(), committable});
+    // Never log the value itself - it's a bearer token
+    std::cerr << "DSID candidate #" << gw.candidates.size();
+    if (session->gateways.size() > 1) std::cerr << " (" << gw.host << ")";
+    std::cerr << ": len=" << value.size()
+              << " status=" << status << " source=" << source
+              << (committable ? "" : " [REJECTED]") << std::endl;
+    if (!committable) return;
+
+    ++gw.generation;
+    CefPostDelayedTask(TID_UI, new QuiesceTask(session, gateway),
+                       static_cast<int64_t>(g_quiesce_seconds * 1000));
+}
+
+bool IsPersistedCookieDomain(std::string domain) {
+    if (!domain.empty() && domain[0] == '.') domain.erase(0, 1);
+    for (auto& c : domain) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    for (const auto& pattern : g_persist_cookie_domains) {
+        if (fnmatch(pattern.c_str(), domain.c_str(), 0) == 0) return true;
+        // "*.okta.com" also covers cookies set for okta.com itself
+        if (pattern.compare(0, 2, "*.") == 0 && domain == pattern.substr(2)) return true;
+    }
+    return false;
+}
+
+// Opens the browser once every gateway's DSID is gone from the cookie store
+class ClearGatewayDSIDsCallback : public CefDeleteCookiesCallback {
+public:
+    explicit ClearGatewayDSIDsCallback(std::shared_ptr<AuthSession> session)
+        : session_(std::move(session)), pending_(session_->gateways.size()) {}
+    void OnComplete(int num_deleted) override {
+        deleted_ += num_deleted;
+        if (--pending_ > 0) return;
+        if (deleted_ > 0) std::cerr << "Cleared " << deleted_ << " stale gateway DSID cookie(s)" << std::endl;
+        CreateAuthBrowser(session_);
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    size_t pending_;
+    int deleted_ = 0;
+    IMPLEMENT_REFCOUNTING(ClearGatewayDSIDsCallback);
+};
+
+class ClearGatewayDSIDsTask : public CefTask {
+public:
+    explicit ClearGatewayDSIDsTask(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void Execute() override {
+        CefRefPtr<CefCookieManager> manager = CefCookieManager::GetGlobalManager(nullptr);
+        CefRefPtr<ClearGatewayDSIDsCallback> callback = new ClearGatewayDSIDsCallback(session_);
+        for (const auto& gw : session_->gateways) {
+            if (!manager || !manager->DeleteCookies(gw.url, "DSID", callback)) callback->OnComplete(0);
+        }
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(ClearGatewayDSIDsTask);
+};
+
+// Deletes the session cookies of domains outside --persist-cookies. CEF
+// releases the visitor once the walk is done, which runs the next step.
+class SessionCookiePurgeVisitor : public CefCookieVisitor {
+public:
+    explicit SessionCookiePurgeVisitor(CefRefPtr<CefTask> then) : then_(then) {}
+    ~SessionCookiePurgeVisitor() override {
+        std::cerr << "Session cookies: kept " << kept_ << " for persisted domains, purged "
+                  << purged_ << std::endl;
+        if (then_) CefPostTask(TID_UI, then_);
+    }
+    bool Visit(const CefCookie& cookie, int count, int total, bool& deleteCookie) override {
+        if (!cookie.has_expires) {
+            if (IsPersistedCookieDomain(CefString(&cookie.domain).ToString())) {
+                kept_++;
+            } else {
+                deleteCookie = true;
+                purged_++;
+            }
+        }
+        return true;
+    }
+private:
+    CefRefPtr<CefTask> then_;
+    int kept_ = 0;
+    int purged_ = 0;
+    IMPLEMENT_REFCOUNTING(SessionCookiePurgeVisitor);
+};
+
+// Bring the cookie store to a known state, then open the auth browser(s).
+// then is null in daemon mode, where each session clears its own DSID.
+void PrepareCookieStore(CefRefPtr<CefTask> then) {
+    if (g_persist_cookie_domains.empty()) {
+        if (then) CefPostTask(TID_UI, then);
+        return;
+    }
+    CefRefPtr<CefCookieManager> manager = CefCookieManager::GetGlobalManager(nullptr);
+    if (!manager || !manager->VisitAllCookies(new SessionCookiePurgeVisitor(then))) {
+        // The visitor was released unused and has already posted then
+        std::cerr << "Could not walk the cookie store; session cookies left as they are" << std::endl;
+    }
+}
+
+// Cookie visitor to find DSID (fallback scan on main-frame load end)
 class DSIDCookieVisitor : public CefCookieVisitor {
 public:
+    DSIDCookieVisitor(std::shared_ptr<AuthSession> session, std::string host)
+        : session_(std::move(session)), host_(std::move(host)) {}
     bool Visit(const CefCookie& cookie, int count, int total, bool& deleteCookie) override {
         std::string name = CefString(&cookie.name).ToString();
         if (name == "DSID") {
-            g_dsid_cookie = CefString(&cookie.value).ToString();
-            g_found_cookie = true;
-            // Close browser - OnBeforeClose will quit the message loop
-            CefPostTask(TID_UI, new CloseBrowserTask());
+            CefPostTask(TID_UI, new DSIDFoundTask(session_, host_, CefString(&cookie.value).ToString(),
+                                                  0, "cookie-store"));
             return false; // Stop visiting
         }
         return true; // Continue
     }
 
 private:
+    std::shared_ptr<AuthSession> session_;
+    std::string host_;
     IMPLEMENT_REFCOUNTING(DSIDCookieVisitor);
 };
 
-// Check for cookie and close browser if found/timeout
-void CheckAndCloseBrowser() {
-    if (g_found_cookie || g_should_close) return;
+// Scan the cookie store for a gateway's DSID
+void ScanCookieStore(const std::shared_ptr<AuthSession>& session, size_t gateway) {
+    if (session->should_close || gateway >= session->gateways.size() || session->gateways[gateway].found) return;
+    CefRefPtr<CefCookieManager> manager = CefCookieManager::GetGlobalManager(nullptr);
+    if (manager) {
+        const GatewayAuth& gw = session->gateways[gateway];
+        manager->VisitUrlCookies(gw.url, true, new DSIDCookieVisitor(session, gw.host));
+    }
+}
 
-    // Check timeout
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - g_start_time);
-    if (elapsed.count() >= g_timeout_seconds) {
+// Task to enforce the authentication timeout. Posted once for the remaining
+// budget instead of waking the UI thread on a fixed interval.
+class TimeoutTask : public CefTask {
+public:
+    explicit TimeoutTask(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void Execute() override {
+        if (session_->ended) return;
+        if (session_->found_cookie || session_->should_close) return;
+        if (std::chrono::steady_clock::now() < session_->deadline) {
+            // Re-arm if the delayed task fired early
+            ScheduleTimeoutCheck(session_);
+            return;
+        }
         std::cerr << "Timeout waiting for authentication" << std::endl;
-        g_should_close = true;
-        if (g_browser) {
-            g_browser->GetHost()->CloseBrowser(true);
+        session_->should_close = true;
+        session_->close_reason = "timeout";
+        StopTracing(session_);
+        CloseAllBrowsers(*session_);
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(TimeoutTask);
+};
+
+void ScheduleTimeoutCheck(const std::shared_ptr<AuthSession>& session) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        session->deadline - std::chrono::steady_clock::now());
+    CefPostDelayedTask(TID_UI, new TimeoutTask(session), std::max<int64_t>(remaining.count(), 0) + 1);
+}
+
+// Open the visible auth browser window for a gateway
+void CreateVisibleBrowser(const std::shared_ptr<AuthSession>& session, size_t gateway) {
+    CEF_REQUIRE_UI_THREAD();
+    GatewayAuth& gw = session->gateways[gateway];
+
+    CefWindowInfo window_info;
+    // Set window title and size for top-level window; extra gateways cascade
+    CefString(&window_info.window_name) = "Pulse VPN Authentication";
+    window_info.bounds.x = 200 + 40 * static_cast<int>(gateway);
+    window_info.bounds.y = 150 + 40 * static_cast<int>(gateway);
+    window_info.bounds.width = 800;
+    window_info.bounds.height = 600;
+
+    // Use Chrome runtime style for WebAuthn/FIDO2 support
+    // Alloy style doesn't have native WebAuthn dialog support
+    window_info.runtime_style = CEF_RUNTIME_STYLE_CHROME;
+
+    CefBrowserSettings browser_settings;
+
+    gw.creating = true;
+    gw.entry_pending = !gw.entry_url.empty();
+    CefBrowserHost::CreateBrowser(window_info, new AuthClient(session, gateway), StartUrl(gw),
+                                   browser_settings, nullptr, nullptr);
+}
+
+// Silent budget spent without a DSID: swap the hidden browser for the real
+// window. Cookies (including any IdP session) live in the shared context.
+// The new window gets a fresh AuthClient, so the legacy Windows-then-Linux UA
+// stage starts over there.
+void EscalateToVisibleBrowser(const std::shared_ptr<AuthSession>& session, size_t gateway) {
+    CEF_REQUIRE_UI_THREAD();
+    GatewayAuth& gw = session->gateways[gateway];
+    std::cerr << "No DSID from " << gw.host << " within " << g_silent_budget_seconds
+              << "s silent budget, showing browser window" << std::endl;
+    MarkPhase(*session, gw, "silent_escalation");
+    CefRefPtr<CefBrowser> hidden = gw.browser;
+    gw.browser = nullptr;
+    gw.silent = false;
+    CreateVisibleBrowser(session, gateway);
+    if (hidden) {
+        hidden->GetHost()->CloseBrowser(true);
+    }
+}
+
+class SilentBudgetTask : public CefTask {
+public:
+    explicit SilentBudgetTask(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void Execute() override {
+        if (session_->ended || session_->should_close) return;
+        for (size_t i = 0; i < session_->gateways.size(); i++) {
+            const GatewayAuth& gw = session_->gateways[i];
+            if (!gw.silent || gw.found) continue;
+            // A valid DSID is already waiting out its quiesce window
+            bool pending = std::any_of(gw.candidates.begin(), gw.candidates.end(),
+                                       [](const DSIDCandidate& c) { return c.committable; });
+            if (!pending) EscalateToVisibleBrowser(session_, i);
         }
-        return;
     }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(SilentBudgetTask);
+};
 
-    // Check for cookie
-    CefRefPtr<CefCookieManager> manager = CefCookieManager::GetGlobalManager(nullptr);
-    if (manager) {
-        CefRefPtr<DSIDCookieVisitor> visitor = new DSIDCookieVisitor();
-        manager->VisitUrlCookies(g_vpn_url, true, visitor);
+// Run a gateway's flow in a hidden windowless browser first
+void CreateSilentBrowser(const std::shared_ptr<AuthSession>& session, size_t gateway) {
+    CEF_REQUIRE_UI_THREAD();
+    GatewayAuth& gw = session->gateways[gateway];
+
+    CefWindowInfo window_info;
+    window_info.SetAsWindowless(0);
+    // Windowless browsers always use Alloy style; WebAuthn needs the visible
+    // Chrome-style window, which is what escalation is for
+    window_info.runtime_style = CEF_RUNTIME_STYLE_ALLOY;
+
+    CefBrowserSettings browser_settings;
+    browser_settings.windowless_frame_rate = 1;
+
+    gw.silent = true;
+    gw.creating = true;
+    gw.entry_pending = !gw.entry_url.empty();
+    CefBrowserHost::CreateBrowser(window_info, new AuthClient(session, gateway, true), StartUrl(gw),
+                                   browser_settings, nullptr, nullptr);
+}
+
+// Open the browsers for gateways [first, last) the configured way: hidden
+// with their own silent budget, or visible
+void OpenGatewayBrowsers(const std::shared_ptr<AuthSession>& session, size_t first, size_t last) {
+    if (g_silent_budget_seconds > 0) {
+        for (size_t i = first; i < last; i++) CreateSilentBrowser(session, i);
+        CefPostDelayedTask(TID_UI, new SilentBudgetTask(session),
+                           static_cast<int64_t>(g_silent_budget_seconds) * 1000);
+    } else {
+        for (size_t i = first; i < last; i++) CreateVisibleBrowser(session, i);
+    }
+}
+
+// The first gateway's IdP round-trip is done: open the rest. Opened any
+// earlier they would load the IdP sign-in form before its session cookie
+// existed and wait there for a second login.
+void StartRemainingGateways(const std::shared_ptr<AuthSession>& session) {
+    CEF_REQUIRE_UI_THREAD();
+    if (session->followers_started || session->should_close) return;
+    session->followers_started = true;
+    if (session->gateways.size() < 2) return;
+    std::cerr << "IdP session established, opening the other " << session->gateways.size() - 1
+              << " gateway(s)" << std::endl;
+    OpenGatewayBrowsers(session, 1, session->gateways.size());
+}
+
+// Start the auth flow with the first gateway and arm the timeout
+void CreateAuthBrowser(const std::shared_ptr<AuthSession>& session) {
+    g_gpu_profile_exercised = true;
+    CefPostTask(TID_FILE_BACKGROUND, new ProcessSampleTask(session));
+    if (g_silent_budget_seconds > 0) {
+        std::cerr << "Trying silent authentication (" << g_silent_budget_seconds << "s budget)" << std::endl;
+    }
+    OpenGatewayBrowsers(session, 0, 1);
+
+    // Arm the timeout; DSID detection itself is event-driven
+    ScheduleTimeoutCheck(session);
+}
+
+// --- Session revalidation --------------------------------------------------
+
+// The DSID is sent as a plain Cookie header without stored credentials, so
+// the check neither reads from nor writes to the profile's cookie store; a
+// rejected DSID can't resurface as a cookie-store candidate in a later flow.
+class RevalidateClient : public CefURLRequestClient {
+public:
+    explicit RevalidateClient(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void OnRequestComplete(CefRefPtr<CefURLRequest> request) override {
+        CEF_REQUIRE_UI_THREAD();
+        AuthSession& session = *session_;
+        session.revalidate_request = nullptr;
+        std::string body;
+        body.swap(session.revalidate_body);
+        CefRefPtr<CefResponse> response = request->GetResponse();
+        int status = response ? response->GetStatus() : 0;
+        MarkPhase(session, "revalidated");
+        if (request->GetRequestStatus() == UR_SUCCESS && status == 200 &&
+            body.find(kRevalidateLiveMarker) != std::string::npos &&
+            body.find(kRevalidateSignInMarker) == std::string::npos) {
+            std::cerr << "Session still valid, skipping the browser flow" << std::endl;
+            session.gateways[0].dsid = g_revalidate_dsid;
+            session.gateways[0].found = true;
+            session.found_cookie = true;
+            EmitResult(session);
+            CefQuitMessageLoop();
+            return;
+        }
+        if (status >= 300 && status < 400) {
+            std::cerr << "Session expired (HTTP " << status << " -> "
+                      << (response ? response->GetHeaderByName("Location").ToString() : "") << ")";
+        } else if (status == 200) {
+            std::cerr << "Session expired (sign-in page served)";
+        } else {
+            std::cerr << "Revalidation failed (status " << status
+                      << ", error " << request->GetRequestError() << ")";
+        }
+        std::cerr << ", starting the browser flow" << std::endl;
+        StartBrowserFlow(session_);
+    }
+    void OnUploadProgress(CefRefPtr<CefURLRequest> request, int64_t current, int64_t total) override {}
+    void OnDownloadProgress(CefRefPtr<CefURLRequest> request, int64_t current, int64_t total) override {}
+    void OnDownloadData(CefRefPtr<CefURLRequest> request, const void* data, size_t data_length) override {
+        std::string& body = session_->revalidate_body;
+        if (body.size() < kRevalidateMaxBody) {
+            body.append(static_cast<const char*>(data), std::min(data_length, kRevalidateMaxBody - body.size()));
+        }
+    }
+    bool GetAuthCredentials(bool isProxy, const CefString& host, int port, const CefString& realm,
+                            const CefString& scheme, CefRefPtr<CefAuthCallback> callback) override {
+        return false;
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(RevalidateClient);
+};
+
+// Cancelling completes the request, which reports the failure and falls
+// through to the browser flow
+class RevalidateTimeoutTask : public CefTask {
+public:
+    explicit RevalidateTimeoutTask(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void Execute() override {
+        if (session_->revalidate_request) session_->revalidate_request->Cancel();
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(RevalidateTimeoutTask);
+};
+
+void StartRevalidation(const std::shared_ptr<AuthSession>& session) {
+    CEF_REQUIRE_UI_THREAD();
+    const std::string& url = session->gateways[0].url;
+    auto scheme = url.find("://");
+    std::string origin = url.substr(0, url.find('/', scheme == std::string::npos ? 0 : scheme + 3));
+
+    CefRefPtr<CefRequest> request = CefRequest::Create();
+    request->SetURL(origin + kRevalidatePath);
+    request->SetMethod("GET");
+    request->SetHeaderByName("Cookie", "DSID=" + g_revalidate_dsid, true);
+    if (!g_mimic_pulse) {
+        // Mimic mode already has its UA as CEF's default
+        request->SetHeaderByName("User-Agent", g_linux_ua, true);
+    }
+    request->SetFlags(UR_FLAG_STOP_ON_REDIRECT | UR_FLAG_SKIP_CACHE | UR_FLAG_NO_RETRY_ON_5XX);
+    std::cerr << "Revalidating existing DSID against " << origin << std::endl;
+    session->revalidate_request = CefURLRequest::Create(request, new RevalidateClient(session), nullptr);
+    CefPostDelayedTask(TID_UI, new RevalidateTimeoutTask(session), kRevalidateTimeoutMs);
+}
+
+// One-shot run: warm up, clear the gateway DSIDs and open the first browser
+void StartBrowserFlow(const std::shared_ptr<AuthSession>& session) {
+    StartTracing(*session);
+    StartPreResolve(session);
+    PrepareCookieStore(new ClearGatewayDSIDsTask(session));
+}
+
+// --- Daemon mode -----------------------------------------------------------
+
+std::string DefaultSocketPath() {
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && *runtime_dir) {
+        return std::string(runtime_dir) + "/pulse-browser-auth.sock";
+    }
+    return "/tmp/pulse-browser-auth-" + std::to_string(getuid()) + ".sock";
+}
+
+// Bind the daemon's listening socket. Returns the fd, -1 on error, or -2 if
+// another daemon is already answering on |path|. The socket is created 0600:
+// replies carry a bearer token.
+int OpenDaemonSocket(const std::string& path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return -1;
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0) {
+        bool running = connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        close(probe);
+        if (running) return -2;
+    }
+    // Nobody listening - clear a stale socket left by a killed daemon
+    unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "socket() failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    mode_t old_umask = umask(077);
+    int rc = bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    umask(old_umask);
+    if (rc != 0 || listen(fd, 8) != 0) {
+        std::cerr << "Cannot listen on " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void WriteAll(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        off += static_cast<size_t>(n);
+    }
+}
+
+// Read one '\n'-terminated request line (bounded, 5 s budget)
+bool ReadRequestLine(int fd, std::string& line) {
+    line.clear();
+    char c;
+    while (line.size() < 8192) {
+        pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, 5000) <= 0) return false;
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        if (c == '\n') {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return true;
+        }
+        line += c;
     }
+    return false;
 }
 
-// Task to check cookies periodically
-class CookieCheckTask : public CefTask {
+// Stop serving. Only reached between requests: the listener reads QUIT
+// only once the current AUTH is answered, and the idle quit needs none
+// active. Should one still be open, its OnBeforeClose quits.
+void QuitDaemon() {
+    CEF_REQUIRE_UI_THREAD();
+    g_daemon_stopping = true;
+    if (g_session_active) return;
+    CefQuitMessageLoop();
+}
+
+class QuitDaemonTask : public CefTask {
+public:
+    void Execute() override { QuitDaemon(); }
+private:
+    IMPLEMENT_REFCOUNTING(QuitDaemonTask);
+};
+
+// Quit the daemon if no request arrived since this task was posted
+class IdleQuitTask : public CefTask {
 public:
+    IdleQuitTask() : requests_(g_daemon_requests) {}
     void Execute() override {
-        if (g_found_cookie || g_should_close) return;
+        if (!g_session_active && requests_ == g_daemon_requests) {
+            std::cerr << "Daemon idle for " << g_idle_timeout_seconds << "s, exiting" << std::endl;
+            QuitDaemon();
+        }
+    }
+private:
+    int requests_;
+    IMPLEMENT_REFCOUNTING(IdleQuitTask);
+};
+
+void ScheduleIdleQuit() {
+    if (g_idle_timeout_seconds > 0) {
+        CefPostDelayedTask(TID_UI, new IdleQuitTask(),
+                           static_cast<int64_t>(g_idle_timeout_seconds) * 1000);
+    }
+}
 
-        CheckAndCloseBrowser();
+// Opens the browser once the previous request's DSID is gone from the cookie
+// store, so the load-end scan can't hand back a stale session cookie.
+class ClearDSIDCallback : public CefDeleteCookiesCallback {
+public:
+    explicit ClearDSIDCallback(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void OnComplete(int num_deleted) override { CreateAuthBrowser(session_); }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(ClearDSIDCallback);
+};
 
-        // Schedule next check (500ms)
-        if (!g_found_cookie && !g_should_close) {
-            CefPostDelayedTask(TID_UI, new CookieCheckTask(), 500);
+class BeginSessionTask : public CefTask {
+public:
+    explicit BeginSessionTask(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void Execute() override {
+        const std::string& url = session_->gateways[0].url;
+        SelectEntryUrls(*session_);
+        StartPreResolve(session_);
+        g_session_active = true;
+        g_daemon_requests++;
+        std::cerr << "Daemon: auth request for " << url << std::endl;
+
+        CefRefPtr<CefCookieManager> manager = CefCookieManager::GetGlobalManager(nullptr);
+        if (!manager || !manager->DeleteCookies(url, "DSID", new ClearDSIDCallback(session_))) {
+            CreateAuthBrowser(session_);
         }
     }
 private:
-    IMPLEMENT_REFCOUNTING(CookieCheckTask);
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(BeginSessionTask);
+};
+
+// Client hung up mid-auth (auth-dialog killed): close the window
+class CancelSessionTask : public CefTask {
+public:
+    explicit CancelSessionTask(std::shared_ptr<AuthSession> session) : session_(std::move(session)) {}
+    void Execute() override {
+        AuthSession& session = *session_;
+        if (session.ended || session.found_cookie || session.should_close) return;
+        std::cerr << "Daemon: client disconnected, cancelling auth" << std::endl;
+        session.should_close = true;
+        session.close_reason = "cancelled";
+        CloseAllBrowsers(session);
+    }
+private:
+    std::shared_ptr<AuthSession> session_;
+    IMPLEMENT_REFCOUNTING(CancelSessionTask);
 };
 
-void ScheduleCookieCheck() {
-    CefPostDelayedTask(TID_UI, new CookieCheckTask(), 500);
+// Publish the finished session's result to the listener thread
+void EndDaemonSession(AuthSession& session) {
+    CEF_REQUIRE_UI_THREAD();
+    if (session.ended) return;
+    session.ended = true;
+    session.sampling = false;
+    g_session_active = false;
+    {
+        std::lock_guard<std::mutex> lock(g_result_mutex);
+        if (session.found_cookie && g_json_output) {
+            session.daemon_reply = ResultJson(session, session.gateways[0]) + "\n";
+        } else if (session.found_cookie) {
+            session.daemon_reply = "DSID=" + session.gateways[0].dsid + "\n";
+        } else {
+            session.daemon_reply = "ERROR " +
+                (session.close_reason.empty() ? std::string("window closed") : session.close_reason) + "\n";
+        }
+    }
+    char b = 1;
+    if (write(g_result_pipe[1], &b, 1) < 0) {
+        std::cerr << "Daemon: result pipe write failed: " << strerror(errno) << std::endl;
+    }
+    EmitTimingMetrics(session, session.found_cookie ? "ok" :
+        (session.close_reason.empty() ? std::string("window closed") : session.close_reason));
+    ScheduleIdleQuit();
+}
+
+// Listener side of an AUTH request: wait for the session result while
+// watching for the client going away.
+void ServeAuthRequest(int fd, const std::string& url, int timeout) {
+    // Built here so the cancel task can name it; only fixed-at-construction
+    // state is touched off the UI thread
+    auto session = std::make_shared<AuthSession>(std::vector<std::string>{url}, timeout);
+    CefPostTask(TID_UI, new BeginSessionTask(session));
+    bool cancelled = false;
+    while (!g_daemon_stopping) {
+        pollfd pfds[2] = {
+            {g_result_pipe[0], POLLIN, 0},
+            {fd, static_cast<short>(cancelled ? 0 : POLLRDHUP), 0},
+        };
+        if (poll(pfds, 2, 1000) < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (pfds[0].revents & POLLIN) {
+            char b;
+            if (read(g_result_pipe[0], &b, 1) != 1) continue;
+            std::string result;
+            {
+                std::lock_guard<std::mutex> lock(g_result_mutex);
+                result.swap(session->daemon_reply);
+            }
+            WriteAll(fd, result);
+            return;
+        }
+        if (!cancelled && (pfds[1].revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+            cancelled = true;
+            CefPostTask(TID_UI, new CancelSessionTask(session));
+        }
+    }
+}
+
+// Listener thread: serves one connection at a time; further clients queue in
+// the listen backlog until the current auth finishes.
+void DaemonListenLoop(int listen_fd, int default_timeout) {
+    while (!g_daemon_stopping) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        std::string line;
+        if (ReadRequestLine(fd, line)) {
+            if (line == "PING") {
+                WriteAll(fd, "PONG\n");
+            } else if (line == "QUIT") {
+                CefPostTask(TID_UI, new QuitDaemonTask());
+                close(fd);
+                break;
+            } else if (line.rfind("AUTH ", 0) == 0) {
+                std::string rest = line.substr(5);
+                std::string url = rest.substr(0, rest.find(' '));
+                int timeout = default_timeout;
+                auto sp = rest.find(' ');
+                if (sp != std::string::npos) {
+                    try {
+                        timeout = std::stoi(rest.substr(sp + 1));
+                    } catch (const std::exception&) {
+                    }
+                }
+                if (url.empty()) {
+                    WriteAll(fd, "ERROR missing url\n");
+                } else {
+                    ServeAuthRequest(fd, url, timeout);
+                }
+            } else {
+                WriteAll(fd, "ERROR unknown command\n");
+            }
+        }
+        close(fd);
+    }
 }
 
 // Application handler
 class AuthApp : public CefApp, public CefBrowserProcessHandler {
 public:
+    // The one-shot run's session (the daemon's placeholder otherwise); set
+    // before CefInitialize
+    void SetSession(std::shared_ptr<AuthSession> session) { session_ = std::move(session); }
+
     CefRefPtr<CefBrowserProcessHandler> GetBrowserProcessHandler() override {
         return this;
     }
@@ -288,22 +3137,69 @@ public:
             command_line->AppendSwitch("no-sandbox");
             command_line->AppendSwitch("disable-setuid-sandbox");
 
-            // Enable features: WebAuthn + GPU acceleration
-            command_line->AppendSwitchWithValue("enable-features",
-                "WebAuthentication,WebAuthenticationConditionalUI,"
-                "Vulkan,SkiaRenderer,CanvasOopRasterization");
+            if (g_gpu_profile == GPU_PROFILE_FULL) {
+                // Enable features: WebAuthn + GPU acceleration
+                command_line->AppendSwitchWithValue("enable-features",
+                    "WebAuthentication,WebAuthenticationConditionalUI,"
+                    "Vulkan,SkiaRenderer,CanvasOopRasterization");
+
+                // GPU acceleration
+                command_line->AppendSwitch("ignore-gpu-blocklist");
+                command_line->AppendSwitch("enable-gpu-rasterization");
+                command_line->AppendSwitch("enable-oop-rasterization");
+                command_line->AppendSwitch("enable-zero-copy");
+
+                // Use native OpenGL on Linux
+                command_line->AppendSwitchWithValue("use-gl", "desktop");
+
+                // Disable software compositing fallback
+                command_line->AppendSwitch("disable-software-rasterizer");
+            } else if (g_gpu_profile == GPU_PROFILE_GL) {
+                // GL compositing via ANGLE; leave Chromium's own fallbacks on
+                command_line->AppendSwitchWithValue("enable-features",
+                    "WebAuthentication,WebAuthenticationConditionalUI");
+                command_line->AppendSwitchWithValue("use-gl", "angle");
+                command_line->AppendSwitchWithValue("use-angle", "gl");
+            } else {
+                command_line->AppendSwitchWithValue("enable-features",
+                    "WebAuthentication,WebAuthenticationConditionalUI");
+                command_line->AppendSwitch("disable-gpu");
+                command_line->AppendSwitch("disable-gpu-compositing");
+            }
 
-            // GPU acceleration
-            command_line->AppendSwitch("ignore-gpu-blocklist");
-            command_line->AppendSwitch("enable-gpu-rasterization");
-            command_line->AppendSwitch("enable-oop-rasterization");
-            command_line->AppendSwitch("enable-zero-copy");
+            if (g_lean) {
+                command_line->AppendSwitch("disable-background-networking");
+                command_line->AppendSwitch("disable-component-update");
+                command_line->AppendSwitch("disable-field-trial-config");
+                command_line->AppendSwitch("disable-domain-reliability");
+                command_line->AppendSwitch("disable-client-side-phishing-detection");
+                command_line->AppendSwitch("safebrowsing-disable-auto-update");
+                command_line->AppendSwitch("disable-sync");
+                command_line->AppendSwitch("disable-default-apps");
+                command_line->AppendSwitch("disable-spell-checking");
+                command_line->AppendSwitch("disable-breakpad");
+                command_line->AppendSwitch("no-default-browser-check");
+                command_line->AppendSwitch("no-pings");
+                command_line->AppendSwitch("metrics-recording-only");
+                command_line->AppendSwitchWithValue("disable-features",
+                    "Translate,OptimizationHints,MediaRouter,DialMediaRouteProvider,"
+                    "AutofillServerCommunication,CertificateTransparencyComponentUpdater");
+            }
 
-            // Use native OpenGL on Linux
-            command_line->AppendSwitchWithValue("use-gl", "desktop");
+            // Enforce the cache cap while running (Chromium evicts LRU)
+            if (g_cache_size_mb > 0) {
+                command_line->AppendSwitchWithValue("disk-cache-size",
+                    std::to_string(static_cast<int64_t>(g_cache_size_mb) * 1024 * 1024));
+            }
 
-            // Disable software compositing fallback
-            command_line->AppendSwitch("disable-software-rasterizer");
+            if (!g_resolve_overrides.empty()) {
+                std::string rules;
+                for (const auto& mapping : g_resolve_overrides) {
+                    if (!rules.empty()) rules += ", ";
+                    rules += "MAP " + mapping.first + " " + mapping.second;
+                }
+                command_line->AppendSwitchWithValue("host-resolver-rules", rules);
+            }
 
             // Set unique app-id for window managers (Wayland app_id / X11 WM_CLASS)
             command_line->AppendSwitchWithValue("class", "pulse-vpn-auth");
@@ -311,57 +3207,114 @@ public:
             // Suppress Chrome first-run behavior
             command_line->AppendSwitch("no-first-run");
 
-            // Load extension if specified
-            if (!g_extension_path.empty()) {
+            // Load extension if specified (and not skipped)
+            if (g_extension_loaded) {
                 command_line->AppendSwitchWithValue("load-extension", g_extension_path);
-            } else if (g_mimic_pulse) {
-                // Match the official Pulse client when no extensions are configured.
+            } else if ((g_mimic_pulse || g_memory_budget_mb > 0) && g_extension_path.empty()) {
+                // Match the official Pulse client when no extensions are configured;
+                // under a memory budget it also saves the extension processes.
                 command_line->AppendSwitch("disable-extensions");
             }
+
+            if (g_memory_budget_mb > 0) {
+                command_line->AppendSwitchWithValue("renderer-process-limit",
+                    g_memory_budget_mb < 512 ? "1" : "2");
+                int heap_mb = std::clamp(g_memory_budget_mb / 4, 64, 512);
+                command_line->AppendSwitchWithValue("js-flags",
+                    "--max-old-space-size=" + std::to_string(heap_mb));
+            }
         }
     }
 
     void OnContextInitialized() override {
         CEF_REQUIRE_UI_THREAD();
 
-        CefWindowInfo window_info;
-        // Set window title and size for top-level window
-        CefString(&window_info.window_name) = "Pulse VPN Authentication";
-        window_info.bounds.x = 200;
-        window_info.bounds.y = 150;
-        window_info.bounds.width = 800;
-        window_info.bounds.height = 600;
 
-        // Use Chrome runtime style for WebAuthn/FIDO2 support
-        // Alloy style doesn't have native WebAuthn dialog support
-        window_info.runtime_style = CEF_RUNTIME_STYLE_CHROME;
-
-        CefBrowserSettings browser_settings;
+        if (g_daemon_mode) {
+            // Context is warm; wait for requests instead of opening a window
+            std::thread(DaemonListenLoop, g_listen_fd, g_timeout_seconds).detach();
+            std::cerr << "Daemon ready on " << g_socket_path << std::endl;
+            PrepareCookieStore(nullptr);
+            ScheduleIdleQuit();
+            return;
+        }
 
-        g_client = new AuthClient();
-        CefBrowserHost::CreateBrowser(window_info, g_client, g_vpn_url,
-                                       browser_settings, nullptr, nullptr);
+        MarkPhase(*session_, "cef_initialized");
+        if (!g_revalidate_dsid.empty()) {
+            StartRevalidation(session_);
+            return;
+        }
+        StartBrowserFlow(session_);
+    }
 
-        // Start periodic cookie checking
-        ScheduleCookieCheck();
+    // A second pulse-browser-auth sharing our profile was started while the
+    // daemon holds it. It has already exited; don't let CEF open a default
+    // window on its behalf.
+    bool OnAlreadyRunningAppRelaunch(CefRefPtr<CefCommandLine> command_line,
+                                     const CefString& current_directory) override {
+        std::cerr << "Ignoring relaunch while running (use the daemon socket)" << std::endl;
+        return true;
     }
 
 private:
+    std::shared_ptr<AuthSession> session_;
     IMPLEMENT_REFCOUNTING(AuthApp);
 };
 
 void PrintUsage(const char* program) {
     std::cerr << "Usage: " << program << " --url <vpn-url> [--timeout <seconds>] [--extension <path>] [--mimic-pulse] [--mimic-pulse-ua <ua>]" << std::endl;
+    std::cerr << "       " << program << " --daemon [--socket <path>] [--idle-timeout <seconds>] [options]" << std::endl;
     std::cerr << std::endl;
     std::cerr << "Opens a browser window, waits for DSID cookie, outputs it." << std::endl;
     std::cerr << "Output format: DSID=<cookie-value>" << std::endl;
+    std::cerr << "Repeat --url to authenticate several gateways in one session; each then" << std::endl;
+    std::cerr << "gets a line \"DSID=<cookie-value> <url>\"; exits 0 only if all succeeded." << std::endl;
     std::cerr << std::endl;
     std::cerr << "Options:" << std::endl;
-    std::cerr << "  --extension <path>     Load unpacked Chrome extension from directory" << std::endl;
+    std::cerr << "  --extension <path>     Load unpacked Chrome extension from directory; skipped for gateways" << std::endl;
+    std::cerr << "                         whose last " << kNoFormRunsToSkip << " sign-ins showed no password form" << std::endl;
+    std::cerr << "  --eager-extension      Always load the --extension, never skip it" << std::endl;
     std::cerr << "  --mimic-pulse          Present as the official Pulse Secure CEF client" << std::endl;
     std::cerr << "                         (single Linux UA with PulseWebClient suffix; no UA switching;" << std::endl;
     std::cerr << "                         extensions disabled when none configured)" << std::endl;
     std::cerr << "  --mimic-pulse-ua <ua>  Override the full mimic-pulse User-Agent string" << std::endl;
+    std::cerr << "  --ua-rule <glob>=<ua>  Legacy mode: always send the windows|linux UA to matching hosts (repeatable)" << std::endl;
+    std::cerr << "  --ua-reload            Legacy mode: reload the first page after the UA switch (old behaviour)" << std::endl;
+    std::cerr << "  --quiesce <seconds>    Commit the latest DSID once none newer arrived for this long (default: 1)" << std::endl;
+    std::cerr << "  --min-dsid-len <n>     Ignore shorter DSIDs, e.g. the SAML placeholder \"DSID=1\" (default: 16)" << std::endl;
+    std::cerr << "  --max-renderer-reloads <n>  Reload the page in place after a renderer crash up to n times" << std::endl;
+    std::cerr << "                         per gateway, then fail (default: 3)" << std::endl;
+    std::cerr << "  --lean                 Disable Chromium subsystems the SSO flow doesn't need (updater," << std::endl;
+    std::cerr << "                         background networking, variations, safe-browsing, spellcheck, sync...)" << std::endl;
+    std::cerr << "  --memory-budget <MB>   Cap renderers and V8 heap, disable unused extension processes," << std::endl;
+    std::cerr << "                         report peak RSS per process type at exit" << std::endl;
+    std::cerr << "  --cache-size-mb <n>    Cap the HTTP cache, least recently used evicted first (default: 64, 0 = unmanaged)" << std::endl;
+    std::cerr << "  --gpu-profile <p>      Rendering profile: auto (default, cached with fallback), gpu, gl, software" << std::endl;
+    std::cerr << "  --block-rules <file>   Cancel subresources matching allow/deny rules (host=, path=, type=)" << std::endl;
+    std::cerr << "  --metrics-file <path>  Append the per-phase timing JSON record here instead of stderr" << std::endl;
+    std::cerr << "  --waterfall            Append a per-request log (host, path, type, status, bytes, timings)" << std::endl;
+    std::cerr << "                         per run to ~/.cache/pulse-browser-auth/waterfall.jsonl" << std::endl;
+    std::cerr << "  --waterfall-file <path>  Same, to this file" << std::endl;
+    std::cerr << "  --trace-file <path>    Record a Chromium trace of the flow (Perfetto / chrome://tracing JSON)" << std::endl;
+    std::cerr << "  --resolve <host>:<ip>  Pin a host's address for the browser (repeatable); the hosts of the" << std::endl;
+    std::cerr << "                         last successful flow are also resolved in parallel at start-up" << std::endl;
+    std::cerr << "  --no-entry-shortcut    Always start at --url instead of the realm SSO entry URL cached" << std::endl;
+    std::cerr << "                         from the last successful flow" << std::endl;
+    std::cerr << "  --persist-cookies <globs>  Keep session cookies of these domains across runs (comma-separated," << std::endl;
+    std::cerr << "                         e.g. *.okta.com); all others and the gateway DSID are cleared at start-up" << std::endl;
+    std::cerr << "  --trust-spki <pins>    Accept gateway certificates with these base64 SHA-256 SPKI pins (comma-separated)" << std::endl;
+    std::cerr << "  --revalidate <dsid>    First check whether this DSID is still a live session (one request," << std::endl;
+    std::cerr << "                         no window) and print it as the result if so; otherwise run the flow" << std::endl;
+    std::cerr << "  --json                 Print {\"dsid\", \"gwcert\", \"gwpin\", \"candidates\", \"renderer_crashes\", \"phases_ms\"}" << std::endl;
+    std::cerr << "                         per gateway instead of DSID= (gwcert/gwpin empty if no gateway page" << std::endl;
+    std::cerr << "                         committed over TLS)" << std::endl;
+    std::cerr << "  --silent-budget <sec>  First try the flow in a hidden window; show it only if no DSID" << std::endl;
+    std::cerr << "                         arrives within this many seconds (default: 0 = always show)" << std::endl;
+    std::cerr << "  --daemon               Keep CEF initialized and serve auth requests on a UNIX socket" << std::endl;
+    std::cerr << "                         (\"AUTH <url> [timeout]\" -> \"DSID=<value>\" | \"ERROR <reason>\";" << std::endl;
+    std::cerr << "                         with --json the result object instead of DSID=)" << std::endl;
+    std::cerr << "  --socket <path>        Daemon socket (default: $XDG_RUNTIME_DIR/pulse-browser-auth.sock)" << std::endl;
+    std::cerr << "  --idle-timeout <sec>   Exit the daemon after this long without a request (default: 600, 0 = never)" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
@@ -377,18 +3330,111 @@ int main(int argc, char* argv[]) {
         return exit_code;
     }
 
-    // This is the main browser process - now parse our arguments
+    // This is the main browser process - warm the bundle, then parse our arguments
+    StartBundleReadahead();
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--url") == 0 && i + 1 < argc) {
-            g_vpn_url = argv[++i];
+            g_gateway_urls.push_back(argv[++i]);
         } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc) {
             g_timeout_seconds = std::stoi(argv[++i]);
         } else if (strcmp(argv[i], "--extension") == 0 && i + 1 < argc) {
             g_extension_path = argv[++i];
+        } else if (strcmp(argv[i], "--eager-extension") == 0) {
+            g_eager_extension = true;
         } else if (strcmp(argv[i], "--mimic-pulse") == 0) {
             g_mimic_pulse = true;
         } else if (strcmp(argv[i], "--mimic-pulse-ua") == 0 && i + 1 < argc) {
             g_mimic_pulse_ua = argv[++i];
+        } else if (strcmp(argv[i], "--ua-rule") == 0 && i + 1 < argc) {
+            std::string rule = argv[++i];
+            auto eq = rule.rfind('=');
+            std::string ua = eq == std::string::npos ? "" : rule.substr(eq + 1);
+            if (eq == 0 || (ua != "windows" && ua != "linux")) {
+                std::cerr << "Invalid --ua-rule " << rule << " (expected <host-glob>=windows|linux)" << std::endl;
+                return 1;
+            }
+            std::string host = rule.substr(0, eq);
+            for (auto& c : host) {
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            }
+            g_ua_rules.push_back({host, ua == "linux"});
+        } else if (strcmp(argv[i], "--no-entry-shortcut") == 0) {
+            g_entry_shortcut = false;
+        } else if (strcmp(argv[i], "--ua-reload") == 0) {
+            g_ua_reload = true;
+        } else if (strcmp(argv[i], "--quiesce") == 0 && i + 1 < argc) {
+            g_quiesce_seconds = std::max(0.0, std::stod(argv[++i]));
+        } else if (strcmp(argv[i], "--min-dsid-len") == 0 && i + 1 < argc) {
+            g_min_dsid_len = static_cast<size_t>(std::max(0, std::stoi(argv[++i])));
+        } else if (strcmp(argv[i], "--max-renderer-reloads") == 0 && i + 1 < argc) {
+            g_max_renderer_reloads = std::max(0, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--silent-budget") == 0 && i + 1 < argc) {
+            g_silent_budget_seconds = std::max(0, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            g_memory_budget_mb = std::max(0, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--lean") == 0) {
+            g_lean = true;
+        } else if (strcmp(argv[i], "--cache-size-mb") == 0 && i + 1 < argc) {
+            g_cache_size_mb = std::max(0, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc) {
+            g_gpu_profile_request = argv[++i];
+            if (g_gpu_profile_request != "auto" && GpuProfileFromName(g_gpu_profile_request) < 0) {
+                std::cerr << "Invalid --gpu-profile " << g_gpu_profile_request
+                          << " (expected auto, gpu, gl or software)" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--block-rules") == 0 && i + 1 < argc) {
+            g_block_rules_file = argv[++i];
+        } else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+            g_metrics_file = argv[++i];
+        } else if (strcmp(argv[i], "--resolve") == 0 && i + 1 < argc) {
+            // openconnect's HOST:IP form; IPv6 addresses keep their colons
+            std::string mapping = argv[++i];
+            auto colon = mapping.find(':');
+            if (colon == std::string::npos || colon == 0 || colon + 1 == mapping.size()) {
+                std::cerr << "Invalid --resolve " << mapping << " (expected <host>:<ip>)" << std::endl;
+                return 1;
+            }
+            std::string host = mapping.substr(0, colon);
+            std::string address = mapping.substr(colon + 1);
+            for (auto& c : host) {
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            }
+            if (address.find(':') != std::string::npos && address.front() != '[') {
+                address = "[" + address + "]";
+            }
+            g_resolve_overrides.push_back({host, address});
+        } else if (strcmp(argv[i], "--trace-file") == 0 && i + 1 < argc) {
+            g_trace_file = argv[++i];
+        } else if (strcmp(argv[i], "--waterfall") == 0) {
+            g_waterfall_file = "-";  // <cache>/waterfall.jsonl, once the cache path is known
+        } else if (strcmp(argv[i], "--waterfall-file") == 0 && i + 1 < argc) {
+            g_waterfall_file = argv[++i];
+        } else if (strcmp(argv[i], "--persist-cookies") == 0 && i + 1 < argc) {
+            std::string list = argv[++i];
+            size_t start = 0;
+            while (start <= list.size()) {
+                size_t comma = list.find(',', start);
+                std::string domain = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+                for (auto& c : domain) {
+                    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                }
+                if (!domain.empty()) g_persist_cookie_domains.push_back(domain);
+                if (comma == std::string::npos) break;
+                start = comma + 1;
+            }
+        } else if (strcmp(argv[i], "--trust-spki") == 0 && i + 1 < argc) {
+            g_trust_spki = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            g_json_output = true;
+        } else if (strcmp(argv[i], "--revalidate") == 0 && i + 1 < argc) {
+            g_revalidate_dsid = argv[++i];
+        } else if (strcmp(argv[i], "--daemon") == 0) {
+            g_daemon_mode = true;
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            g_socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            g_idle_timeout_seconds = std::stoi(argv[++i]);
         } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             PrintUsage(argv[0]);
             return 0;
@@ -396,18 +3442,50 @@ int main(int argc, char* argv[]) {
         // Ignore CEF's internal arguments (--type=, etc.)
     }
 
-    if (g_vpn_url.empty()) {
+    if (g_gateway_urls.empty() && !g_daemon_mode) {
         PrintUsage(argv[0]);
         return 1;
     }
+    if (!g_revalidate_dsid.empty()) {
+        if (g_daemon_mode || g_gateway_urls.size() != 1) {
+            std::cerr << "--revalidate takes exactly one --url and no --daemon" << std::endl;
+            return 1;
+        }
+    }
+    if (!g_trace_file.empty() && g_daemon_mode) {
+        std::cerr << "--trace-file is not supported with --daemon" << std::endl;
+        return 1;
+    }
+    if (!g_block_rules_file.empty() && !LoadBlockRules(g_block_rules_file)) {
+        return 1;
+    }
+
+    if (g_daemon_mode) {
+        if (g_socket_path.empty()) {
+            g_socket_path = DefaultSocketPath();
+        }
+        // Bind before CefInitialize so a second daemon bails out cheaply
+        g_listen_fd = OpenDaemonSocket(g_socket_path);
+        if (g_listen_fd == -2) {
+            std::cerr << "Daemon already running on " << g_socket_path << std::endl;
+            return 0;
+        }
+        if (g_listen_fd < 0 || pipe2(g_result_pipe, O_CLOEXEC) != 0) {
+            return 1;
+        }
+    }
 
-    // Record start time for timeout
-    g_start_time = std::chrono::steady_clock::now();
+    // The one-shot session starts the timeout; the daemon's placeholder has no gateways
+    auto session = std::make_shared<AuthSession>(
+        g_daemon_mode ? std::vector<std::string>() : g_gateway_urls, g_timeout_seconds);
+    g_process_start = session->start_time;
+    app->SetSession(session);
 
     // CEF settings
     CefSettings settings;
     settings.no_sandbox = true;
-    settings.windowless_rendering_enabled = false;
+    // Only enabled when needed: CEF warns it can slow down windowed rendering
+    settings.windowless_rendering_enabled = g_silent_budget_seconds > 0;
 
     if (g_mimic_pulse) {
         // Mimic the official Pulse client: a single Linux UA with the
@@ -416,7 +3494,8 @@ int main(int argc, char* argv[]) {
         // which would replace the "Chrome/<ver>" portion entirely) keeps both
         // Chrome and PulseWebClient tokens present and aligns HTTP with
         // navigator.userAgent. Session cookies are NOT persisted here so the
-        // periodic cookie scanner can't latch onto a stale DSID from a prior run.
+        // cookie scanner can't latch onto a stale DSID from a prior run
+        // (unless --persist-cookies names IdP domains to keep, see below).
         CefString(&settings.user_agent) = g_mimic_pulse_ua;
     } else {
         // Legacy behavior: Windows UA initially, switched to Linux after first load
@@ -425,11 +3504,33 @@ int main(int argc, char* argv[]) {
         CefString(&settings.user_agent) = g_windows_ua;
     }
 
+#ifdef PULSE_AUTH_BUNDLE_LOCALE
+    CefString(&settings.locale) = PULSE_AUTH_BUNDLE_LOCALE;
+    std::string accept_language = AcceptLanguageFromEnv();
+    if (!accept_language.empty()) CefString(&settings.accept_language_list) = accept_language;
+#endif
+
+    settings.persist_session_cookies = !g_persist_cookie_domains.empty();
+
     // Set cache path for persistent cookies/sessions
     std::string cache_path = std::string(getenv("HOME") ? getenv("HOME") : "/tmp") + "/.cache/pulse-browser-auth";
     CefString(&settings.root_cache_path) = cache_path;
     CefString(&settings.cache_path) = cache_path;
 
+    // Pick the rendering profile before CEF reads the command line
+    mkdir((std::string(getenv("HOME") ? getenv("HOME") : "/tmp") + "/.cache").c_str(), 0700);
+    mkdir(cache_path.c_str(), 0700);
+    g_cache_path = cache_path;
+    g_resolve_hosts_file = cache_path + "/resolve-hosts";
+    g_entry_urls_file = cache_path + "/entry-urls";
+    SelectEntryUrls(*session);
+    if (g_waterfall_file == "-") g_waterfall_file = cache_path + "/waterfall.jsonl";
+    g_cache_at_start = CollectCacheStats(HttpCacheDir());
+    g_gpu_state_file = cache_path + "/gpu-profile";
+    SelectGpuProfile();
+    g_extension_skip_file = cache_path + "/extension-skip-hosts";
+    SelectExtensionLoading(*session);
+
     if (!CefInitialize(main_args, settings, app, nullptr)) {
         std::cerr << "CEF initialization failed" << std::endl;
         return 1;
@@ -438,15 +3539,26 @@ int main(int argc, char* argv[]) {
     // Run the CEF message loop - this is the proper way
     // It handles all events efficiently and returns when CefQuitMessageLoop() is called
     CefRunMessageLoop();
-
-    // Output the cookie if found
-    if (g_found_cookie) {
-        std::cout << "DSID=" << g_dsid_cookie << std::endl;
+    ReleaseGpuProfile();
+    SaveNavigatedHosts(*session);
+    ReportCacheStats();
+    ReportPeakMemory();
+
+    if (g_daemon_mode) {
+        // Unblock the listener's accept() and remove the socket
+        g_daemon_stopping = true;
+        shutdown(g_listen_fd, SHUT_RDWR);
+        unlink(g_socket_path.c_str());
     }
 
-    // Cleanup - browser is already closed at this point
-    g_client = nullptr;
+    // Already done when the DSID was accepted; covers timeouts and closed windows
+    EmitResult(*session);
+
+    // Cleanup - browsers are already closed at this point
     CefShutdown();
 
-    return g_found_cookie ? 0 : 1;
+    if (g_daemon_mode) {
+        return 0;
+    }
+    return session->found_cookie ? 0 : 1;
 }
@@ -15,6 +15,9 @@
   iproute2,
   iptables,
   cef-pulse-auth,
+  # { cert, key, spki } of the local capture proxy for the auth-dialog's race
+  # mode (generated in module.nix); null leaves race mode off
+  raceProxy ? null,
 }:
 
 let
@@ -62,6 +65,12 @@ stdenv.mkDerivation rec {
     # Install the auth-dialog (simple Python script that calls CEF binary)
     install -Dm755 auth-dialog/pulse-sso-auth-dialog $out/libexec/pulse-sso-auth-dialog
 
+    # Capture proxy for race mode. Under $out/share/ as plain source so
+    # wrapGAppsHook3 doesn't turn it into an ELF wrapper (see browser-auth/)
+    ${lib.optionalString (raceProxy != null) ''
+      install -Dm644 browser-auth/proxy.py $out/share/nm-pulse-sso/proxy.py
+    ''}
+
     # Create .name file with paths substituted
     mkdir -p $out/lib/NetworkManager/VPN
     substitute dbus/nm-pulse-sso-service.name.in \
@@ -89,11 +98,23 @@ stdenv.mkDerivation rec {
       --set PYTHONPATH "${pythonEnvService}/${pythonEnvService.sitePackages}" \
       --set VPNC_SCRIPT "${vpnc-scripts}/bin/vpnc-script"
 
-    # Wrap the auth-dialog with path to CEF binary
+    ${lib.optionalString (raceProxy != null) ''
+      makeWrapper ${pythonEnvAuthDialog}/bin/python3 $out/bin/pulse-browser-proxy \
+        --add-flags "$out/share/nm-pulse-sso/proxy.py"
+    ''}
+
+    # Wrap the auth-dialog with path to CEF binary (systemd-run starts CEF
+    # in its own scope)
     wrapProgram $out/libexec/pulse-sso-auth-dialog \
       --set PYTHONHOME "${pythonEnvAuthDialog}" \
-      --prefix PATH : "${pythonEnvAuthDialog}/bin" \
-      --add-flags "--cef-binary ${cef-pulse-auth}/bin/pulse-browser-auth"
+      --prefix PATH : "${pythonEnvAuthDialog}/bin:${lib.makeBinPath [ systemd ]}" \
+      --add-flags "--cef-binary ${cef-pulse-auth}/bin/pulse-browser-auth" \
+      ${lib.optionalString (raceProxy != null) ''
+        --add-flags "--race-proxy-binary $out/bin/pulse-browser-proxy" \
+        --add-flags "--race-cert ${raceProxy.cert}" \
+        --add-flags "--race-key ${raceProxy.key}" \
+        --add-flags "--race-spki-file ${raceProxy.spki}"
+      ''}
   '';
 
   meta = with lib; {
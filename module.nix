@@ -45,10 +45,18 @@ let
         -CA $out/ca.crt -CAkey $out/ca.key -CAcreateserial \
         -out $out/server.crt \
         -extfile <(printf 'subjectAltName=DNS:%s\n' "$HOSTNAME")
+
+      # SPKI pin of the server cert, trusted by the CEF browser in race mode
+      openssl x509 -in $out/server.crt -pubkey -noout \
+        | openssl pkey -pubin -outform der \
+        | openssl dgst -sha256 -binary \
+        | openssl enc -base64 > $out/server.spki
     '';
 
   # CEF-based authentication browser
-  pulse-browser-auth-base = pkgs.callPackage ./cef-auth/default.nix { };
+  pulse-browser-auth-base = pkgs.callPackage ./cef-auth/default.nix {
+    prunedBundle = cfg.prunedCefBundle;
+  };
 
   # Extract extension IDs from packages that provide passthru.extensionId
   extensionIds = lib.filter (id: id != null)
@@ -90,8 +98,14 @@ let
     fi
   '';
 
-  # Wrap browser to load extensions and/or enable --mimic-pulse mode if configured
-  needsBrowserWrap = cfg.extensions != [] || cfg.mimicOfficialPulseCef;
+  blockRulesFile = pkgs.writeText "pulse-browser-auth-block-rules"
+    (lib.concatStringsSep "\n" cfg.authBlockRules + "\n");
+
+  # Wrap browser to load extensions, enable --mimic-pulse mode, silent auth and/or block rules if configured
+  needsBrowserWrap = cfg.extensions != [] || cfg.mimicOfficialPulseCef
+    || cfg.silentAuthBudget != null || cfg.authBlockRules != [] || cfg.legacyUaRules != []
+    || cfg.gpuProfile != "auto" || cfg.leanAuthBrowser || cfg.authMemoryBudget != null
+    || cfg.eagerExtensions || cfg.persistIdpCookies != [] || cfg.captureAuthWaterfall;
   pulse-browser-auth = if !needsBrowserWrap then pulse-browser-auth-base
     else pkgs.symlinkJoin {
       name = "pulse-browser-auth-wrapped";
@@ -100,7 +114,16 @@ let
       postBuild = ''
         wrapProgram $out/bin/pulse-browser-auth \
           ${lib.optionalString cfg.mimicOfficialPulseCef ''--add-flags "--mimic-pulse"''} \
+          ${lib.optionalString (cfg.silentAuthBudget != null) ''--add-flags "--silent-budget ${toString cfg.silentAuthBudget}"''} \
+          ${lib.optionalString cfg.leanAuthBrowser ''--add-flags "--lean"''} \
+          ${lib.optionalString cfg.captureAuthWaterfall ''--add-flags "--waterfall"''} \
+          ${lib.optionalString (cfg.authMemoryBudget != null) ''--add-flags "--memory-budget ${toString cfg.authMemoryBudget}"''} \
+          ${lib.optionalString (cfg.gpuProfile != "auto") ''--add-flags "--gpu-profile ${cfg.gpuProfile}"''} \
+          ${lib.concatMapStringsSep " " (r: ''--add-flags "--ua-rule ${r}"'') cfg.legacyUaRules} \
+          ${lib.optionalString (cfg.authBlockRules != []) ''--add-flags "--block-rules ${blockRulesFile}"''} \
+          ${lib.optionalString (cfg.persistIdpCookies != []) ''--add-flags "--persist-cookies ${lib.concatStringsSep "," cfg.persistIdpCookies}"''} \
           ${lib.optionalString (cfg.extensions != []) ''--add-flags "--extension ${lib.concatStringsSep "," cfg.extensions}"''} \
+          ${lib.optionalString (cfg.extensions != [] && cfg.eagerExtensions) ''--add-flags "--eager-extension"''} \
           ${lib.optionalString (cfg.extensions != [] && cfg.pinExtensions) "--run ${pinExtensionsScript}"}
       '';
     };
@@ -118,6 +141,11 @@ let
     else
       pkgs.callPackage ./default.nix {
         cef-pulse-auth = pulse-browser-auth;
+        raceProxy = if cfg.authRace then {
+          cert = "${browser-auth-pki}/server.crt";
+          key  = "${browser-auth-pki}/server.key";
+          spki = "${browser-auth-pki}/server.spki";
+        } else null;
       };
 
   # Browser setup tool for installing extensions, configuring settings, etc.
@@ -130,6 +158,7 @@ let
     echo "Close the browser when done. Settings persist in ~/.cache/pulse-browser-auth"
     exec ${pulse-browser-auth}/bin/pulse-browser-auth \
       --url "https://chromewebstore.google.com" \
+      --eager-extension \
       --timeout 3600
   '';
 
@@ -385,6 +414,19 @@ in
       '';
     };
 
+    eagerExtensions = lib.mkOption {
+      type = lib.types.bool;
+      default = false;
+      description = ''
+        Load the configured extensions on every auth run. By default they
+        are loaded too, except for gateways whose last 3 sign-ins showed no
+        password form on the identity provider's pages (remembered for 30
+        days in ~/.cache/pulse-browser-auth/extension-skip-hosts); a password
+        form takes the gateway off that list again. The pre-warmed daemon
+        always loads them.
+      '';
+    };
+
     pinExtensions = lib.mkOption {
       type = lib.types.bool;
       default = true;
@@ -418,6 +460,178 @@ in
       '';
     };
 
+    prewarmAuthBrowser = lib.mkOption {
+      type = lib.types.bool;
+      default = false;
+      description = ''
+        Keep a pre-initialized CEF authentication browser running after
+        suspend/resume. The VPN service starts `pulse-browser-auth --daemon`
+        in the user's session when the system resumes; the auth-dialog then
+        sends its request to the daemon over a UNIX socket instead of
+        cold-starting CEF, cutting time-to-tunnel on reconnect. The daemon
+        exits after 10 minutes without a request. CEF backend only.
+      '';
+    };
+
+    plasmaInProcessAuth = lib.mkOption {
+      type = lib.types.bool;
+      default = false;
+      description = ''
+        On KDE Plasma, run the SSO login inside plasma-nm's secrets dialog
+        (Qt WebEngine, already loaded in the session) instead of spawning the
+        separate CEF browser, saving its cold start and memory. The service
+        then asks NetworkManager's secrets agent for the cookie on the first
+        connect; re-authentication after a rejected cookie still uses the
+        configured browser backend. Only enable this on Plasma desktops:
+        other agents fall back to running the auth-dialog themselves.
+      '';
+    };
+
+    silentAuthBudget = lib.mkOption {
+      type = lib.types.nullOr lib.types.ints.positive;
+      default = null;
+      example = 8;
+      description = ''
+        Seconds to attempt authentication in a hidden, windowless CEF browser
+        before showing the login window. When the IdP session is still valid
+        the SAML flow completes without user input, so reconnects finish
+        without a window ever appearing. If no DSID arrives within the budget
+        the visible window opens and the flow continues there. `null` always
+        shows the window. CEF backend only.
+      '';
+    };
+
+    leanAuthBrowser = lib.mkOption {
+      type = lib.types.bool;
+      default = false;
+      description = ''
+        Launch the CEF authentication browser with `--lean`, turning off
+        Chromium subsystems the SSO flow does not use (background
+        networking, component updater, variations, safe-browsing updates,
+        spellcheck, sync, translate, media router, crash reporter). WebAuthn
+        and extensions are unaffected. The per-run METRICS log line reports
+        startup phases and process count to compare against.
+      '';
+    };
+
+    authRace = lib.mkOption {
+      type = lib.types.bool;
+      default = false;
+      description = ''
+        Race the CEF browser's cookie capture against the browser-auth
+        capture proxy on the same login. The auth-dialog starts the proxy
+        on the service's per-session loopback port and points the CEF
+        browser at it for the gateway host only (trusting just the proxy's
+        certificate). The first real DSID, seen either in CEF's cookie
+        store or in the gateway's Set-Cookie headers, wins and the other
+        side is stopped. A stalled cookie capture then costs about a second
+        instead of the 300-second timeout. If the proxy fails, the flow
+        falls back to CEF alone. The proxy key is in the Nix store, like
+        for enableDesktopBrowserAuth. CEF backend only; not used by the
+        pre-warmed daemon.
+      '';
+    };
+
+    prunedCefBundle = lib.mkOption {
+      type = lib.types.bool;
+      default = false;
+      description = ''
+        Install a pruned CEF bundle with the auth browser: libcef, the
+        ANGLE libraries, the V8 snapshot, ICU data, the resource paks and
+        only the en-US locale, without SwiftShader, chrome-sandbox and the
+        other locales. Cuts the install size and what a cold start after
+        boot has to read; the browser UI is then always in English (web
+        pages still get the session's language). Disable to go back to the
+        full bundle if something is missing.
+      '';
+    };
+
+    captureAuthWaterfall = lib.mkOption {
+      type = lib.types.bool;
+      default = false;
+      description = ''
+        Record every request of the CEF authentication browser (host,
+        path, resource type, status, bytes, start/response/end offsets and
+        whether it came from the HTTP cache). Each run is appended as one
+        JSON line to ~/.cache/pulse-browser-auth/waterfall.jsonl, which is
+        rotated at 4 MB. The capture goes to a preallocated buffer and is
+        written once at the end of a run, so it is cheap enough to leave on
+        while chasing IdP-side slowness.
+      '';
+    };
+
+    authMemoryBudget = lib.mkOption {
+      type = lib.types.nullOr lib.types.ints.positive;
+      default = null;
+      example = 400;
+      description = ''
+        Memory budget in MB for the CEF authentication browser. Caps the
+        renderer process count, limits the V8 heap to a quarter of the
+        budget and disables extension processes when no extensions are
+        configured. Peak RSS per process type (browser, gpu-process,
+        renderer, utility, ...) is logged at exit for tuning. `null`
+        leaves Chromium's defaults.
+      '';
+    };
+
+    gpuProfile = lib.mkOption {
+      type = lib.types.enum [ "auto" "gpu" "gl" "software" ];
+      default = "auto";
+      description = ''
+        Rendering profile of the CEF authentication browser. `auto` starts
+        with full GPU acceleration and caches the result per user in
+        ~/.cache/pulse-browser-auth/gpu-profile; after two runs in a row
+        that never finish a page load (GPU process crash, blank window) it
+        falls back to `gl` (GL compositing only) and then `software`.
+        Set a fixed profile to skip detection.
+      '';
+    };
+
+    persistIdpCookies = lib.mkOption {
+      type = lib.types.listOf lib.types.str;
+      default = [];
+      example = [ "*.okta.com" "login.microsoftonline.com" ];
+      description = ''
+        Domain globs whose session cookies the CEF authentication browser
+        keeps across runs. A still-valid IdP/MFA session then completes the
+        SAML flow on reconnect without user input. All other session
+        cookies are purged when the browser starts, and the gateway's DSID
+        is always deleted before the login page opens. Empty keeps the
+        default of not persisting session cookies.
+      '';
+    };
+
+    legacyUaRules = lib.mkOption {
+      type = lib.types.listOf (lib.types.strMatching "[^=]+=(windows|linux)");
+      default = [];
+      example = [ "*.okta.com=windows" "vpn.example.com=linux" ];
+      description = ''
+        Per-host user agent rules for the legacy (non-mimic) CEF mode, as
+        `<host-glob>=windows|linux`. Matching requests always get that UA;
+        other hosts get the Windows UA until the first page has loaded and
+        the Linux UA after it. Only used when mimicOfficialPulseCef is off.
+      '';
+    };
+
+    authBlockRules = lib.mkOption {
+      type = lib.types.listOf lib.types.str;
+      default = [];
+      example = [
+        "deny host=*.google-analytics.com"
+        "deny host=*.doubleclick.net"
+        "deny type=font,media"
+      ];
+      description = ''
+        Resource blocking rules for the CEF authentication browser, one
+        `allow|deny [host=<glob>] [path=<glob>] [type=<t>,...]` rule per
+        entry; the first matching rule wins and unmatched requests load.
+        Blocked analytics beacons, fonts and marketing images are cancelled
+        before they reach the network, which speeds up IdP page loads on
+        slow links. Main-frame navigations and gateway requests are never
+        blocked. CEF backend only.
+      '';
+    };
+
     restartBeforeServices = lib.mkOption {
       type = lib.types.listOf lib.types.str;
       default = [];
@@ -683,6 +897,8 @@ in
         ENABLE_TCP_KEEPALIVE=${if cfg.enableTcpKeepalive then "true" else "false"}
         TCP_KEEPALIVE_INTERVAL=${if cfg.tcpKeepaliveInterval != null then toString cfg.tcpKeepaliveInterval else ""}
         ${lib.optionalString (cfg.mtu != null) "VPN_MTU=${toString cfg.mtu}"}
+        PLASMA_INPROCESS_AUTH=${if cfg.plasmaInProcessAuth then "true" else "false"}
+        PREWARM_AUTH_BROWSER=${if cfg.prewarmAuthBrowser && !cfg.enableSelenium && !cfg.enableDesktopBrowserAuth then "true" else "false"}
       '';
     };
 
@@ -6,6 +6,9 @@
 final: prev: {
   kdePackages = prev.kdePackages.overrideScope (kfinal: kprev: {
     plasma-nm = kprev.plasma-nm.overrideAttrs (oldAttrs: {
+      # Qt WebEngine backs the plugin's in-process login (askUser)
+      buildInputs = (oldAttrs.buildInputs or [ ]) ++ [ kprev.qtwebengine ];
+
       # Add our plugin source to the build
       postPatch = (oldAttrs.postPatch or "") + ''
         # Create directory for our plugin
@@ -18,6 +21,8 @@ final: prev: {
         cp ${plasma-plugin-src}/pulsessowidget.h vpn/pulsesso/
         cp ${plasma-plugin-src}/pulsessowidget.cpp vpn/pulsesso/
         cp ${plasma-plugin-src}/pulsessowidget.ui vpn/pulsesso/
+        cp ${plasma-plugin-src}/pulsessoauth.h vpn/pulsesso/
+        cp ${plasma-plugin-src}/pulsessoauth.cpp vpn/pulsesso/
         cp ${plasma-plugin-src}/CMakeLists.txt vpn/pulsesso/
 
         # Add our plugin directory to the main vpn CMakeLists.txt
@@ -0,0 +1,146 @@
+/*
+    SPDX-FileCopyrightText: 2024 Ellis Rahhal <github@rahh.al>
+    SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "pulsessoauth.h"
+
+#include <KLocalizedString>
+
+#include <QDialog>
+#include <QLabel>
+#include <QVBoxLayout>
+#include <QWebEngineCookieStore>
+#include <QWebEnginePage>
+#include <QWebEngineProfile>
+#include <QWebEngineView>
+
+// Same acceptance rules as cef-pulse-auth: Pulse sets a placeholder DSID
+// ("DSID=1") mid-flow and clears it with an empty or "deleted" value, and a
+// real session token is a ~32-char hex string. The candidate is committed
+// once no newer DSID has arrived for the quiesce interval.
+static const int s_minDsidLength = 16;
+static const int s_quiesceMs = 1000;
+
+static bool looksLikeRealDsid(const QString &value)
+{
+    QString bare = value;
+    bare.remove(QLatin1Char('"'));
+    const QString lower = bare.toLower();
+    if (lower.isEmpty() || lower == QLatin1String("deleted") || lower == QLatin1String("null") || lower == QLatin1String("0")) {
+        return false;
+    }
+    return bare.size() >= s_minDsidLength;
+}
+
+PulseSsoAuthWidget::PulseSsoAuthWidget(const NetworkManager::VpnSetting::Ptr &setting, QWidget *parent)
+    : SettingWidget(setting, parent)
+    , m_setting(setting)
+{
+    QString gateway = setting->data().value(QStringLiteral("gateway"));
+    if (!gateway.startsWith(QLatin1String("http://")) && !gateway.startsWith(QLatin1String("https://"))) {
+        gateway.prepend(QLatin1String("https://"));
+    }
+    m_gateway = QUrl(gateway);
+
+    auto layout = new QVBoxLayout(this);
+    m_status = new QLabel(i18n("Sign in to %1 to connect.", m_gateway.host()), this);
+    m_status->setWordWrap(true);
+    layout->addWidget(m_status);
+
+    // A named profile keeps the IdP's own session cookies on disk, so a
+    // still-valid SSO session completes without user input next time
+    m_profile = new QWebEngineProfile(QStringLiteral("pulse-sso"), this);
+    m_view = new QWebEngineView(this);
+    m_view->setPage(new QWebEnginePage(m_profile, m_view));
+    m_view->setMinimumSize(640, 560);
+    layout->addWidget(m_view, 1);
+
+    m_quiesce.setSingleShot(true);
+    m_quiesce.setInterval(s_quiesceMs);
+    connect(&m_quiesce, &QTimer::timeout, this, &PulseSsoAuthWidget::commitCookie);
+
+    // Drop a DSID left behind by an earlier login before the new one starts
+    QWebEngineCookieStore *store = m_profile->cookieStore();
+    store->deleteCookie(QNetworkCookie(QByteArrayLiteral("DSID")), m_gateway);
+    connect(store, &QWebEngineCookieStore::cookieAdded, this, &PulseSsoAuthWidget::onCookieAdded);
+    connect(store, &QWebEngineCookieStore::cookieRemoved, this, &PulseSsoAuthWidget::onCookieRemoved);
+
+    m_view->load(m_gateway);
+}
+
+PulseSsoAuthWidget::~PulseSsoAuthWidget()
+{
+    // The page must go before the profile it was created with
+    delete m_view;
+}
+
+bool PulseSsoAuthWidget::isGatewayDsid(const QNetworkCookie &cookie) const
+{
+    if (cookie.name() != QByteArrayLiteral("DSID")) {
+        return false;
+    }
+    // Only the gateway's own DSID is a session cookie; IdPs can set one too
+    QString domain = cookie.domain();
+    if (domain.startsWith(QLatin1Char('.'))) {
+        domain.remove(0, 1);
+    }
+    return domain.compare(m_gateway.host(), Qt::CaseInsensitive) == 0;
+}
+
+void PulseSsoAuthWidget::onCookieAdded(const QNetworkCookie &cookie)
+{
+    if (!m_cookie.isEmpty() || !isGatewayDsid(cookie)) {
+        return;
+    }
+    const QString value = QString::fromLatin1(cookie.value());
+    if (!looksLikeRealDsid(value)) {
+        m_candidate.clear();
+        m_quiesce.stop();
+        return;
+    }
+    m_candidate = value;
+    m_quiesce.start();
+}
+
+void PulseSsoAuthWidget::onCookieRemoved(const QNetworkCookie &cookie)
+{
+    if (!m_cookie.isEmpty() || !isGatewayDsid(cookie) || QString::fromLatin1(cookie.value()) != m_candidate) {
+        return;
+    }
+    m_candidate.clear();
+    m_quiesce.stop();
+}
+
+void PulseSsoAuthWidget::commitCookie()
+{
+    if (m_candidate.isEmpty()) {
+        return;
+    }
+    m_cookie = m_candidate;
+    m_view->stop();
+    m_status->setText(i18n("Signed in to %1.", m_gateway.host()));
+    Q_EMIT validChanged(true);
+
+    // Nothing left for the user to do; close plasma-nm's secrets dialog so
+    // NetworkManager gets the cookie right away
+    if (auto dialog = qobject_cast<QDialog *>(window())) {
+        dialog->accept();
+    }
+}
+
+QVariantMap PulseSsoAuthWidget::setting() const
+{
+    NMStringMap secrets;
+    secrets.insert(QStringLiteral("cookie"), m_cookie);
+    secrets.insert(QStringLiteral("authmethod"), QStringLiteral("plasma-webengine"));
+
+    QVariantMap secretData;
+    secretData.insert(QStringLiteral("secrets"), QVariant::fromValue<NMStringMap>(secrets));
+    return secretData;
+}
+
+bool PulseSsoAuthWidget::isValid() const
+{
+    return !m_cookie.isEmpty();
+}
@@ -0,0 +1,53 @@
+/*
+    SPDX-FileCopyrightText: 2024 Ellis Rahhal <github@rahh.al>
+    SPDX-License-Identifier: GPL-2.0-or-later
+
+    In-process SAML login for Pulse SSO VPN connections, shown by plasma-nm's
+    secrets dialog. Runs the gateway login in Qt WebEngine and hands the
+    DSID cookie back to NetworkManager as the "cookie" VPN secret.
+*/
+
+#ifndef PLASMA_NM_PULSE_SSO_AUTH_H
+#define PLASMA_NM_PULSE_SSO_AUTH_H
+
+#include "settingwidget.h"
+
+#include <NetworkManagerQt/VpnSetting>
+
+#include <QNetworkCookie>
+#include <QTimer>
+#include <QUrl>
+
+class QLabel;
+class QWebEngineProfile;
+class QWebEngineView;
+
+class PulseSsoAuthWidget : public SettingWidget
+{
+    Q_OBJECT
+public:
+    explicit PulseSsoAuthWidget(const NetworkManager::VpnSetting::Ptr &setting, QWidget *parent = nullptr);
+    ~PulseSsoAuthWidget() override;
+
+    QVariantMap setting() const override;
+    bool isValid() const override;
+
+private Q_SLOTS:
+    void onCookieAdded(const QNetworkCookie &cookie);
+    void onCookieRemoved(const QNetworkCookie &cookie);
+    void commitCookie();
+
+private:
+    bool isGatewayDsid(const QNetworkCookie &cookie) const;
+
+    NetworkManager::VpnSetting::Ptr m_setting;
+    QUrl m_gateway;
+    QWebEngineProfile *m_profile;
+    QWebEngineView *m_view;
+    QLabel *m_status;
+    QTimer m_quiesce;
+    QString m_candidate;
+    QString m_cookie;
+};
+
+#endif // PLASMA_NM_PULSE_SSO_AUTH_H
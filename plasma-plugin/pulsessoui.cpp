@@ -5,6 +5,9 @@
 
 #include "pulsessoui.h"
 #include "pulsessowidget.h"
+#if WITH_WEBENGINE
+#include "pulsessoauth.h"
+#endif
 
 #include <KPluginFactory>
 
@@ -24,12 +27,19 @@ SettingWidget *PulseSsoUiPlugin::widget(const NetworkManager::VpnSetting::Ptr &s
 
 SettingWidget *PulseSsoUiPlugin::askUser(const NetworkManager::VpnSetting::Ptr &setting, const QStringList &hints, QWidget *parent)
 {
-    Q_UNUSED(setting);
     Q_UNUSED(hints);
+#if WITH_WEBENGINE
+    // Only reached when the service asks NetworkManager for secrets, i.e. with
+    // plasmaInProcessAuth enabled; the login then runs inside plasma-nm
+    // instead of a separate CEF process
+    return new PulseSsoAuthWidget(setting, parent);
+#else
+    Q_UNUSED(setting);
     Q_UNUSED(parent);
     // Return nullptr - authentication is handled by the VPN service directly
     // via browser popup, not through a KDE widget
     return nullptr;
+#endif
 }
 
 QString PulseSsoUiPlugin::suggestedFileName(const NetworkManager::ConnectionSettings::Ptr &connection) const
@@ -11,6 +11,60 @@
 #include <NetworkManagerQt/Setting>
 #include <NetworkManagerQt/VpnSetting>
 
+#include <KFormat>
+#include <KLocalizedString>
+
+#include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+
+// The VPN service publishes a read-only diagnostics snapshot on its plugin
+// object; the panel follows its DiagnosticsChanged signal
+static const QString s_serviceName = QStringLiteral("org.freedesktop.NetworkManager.pulse-sso");
+static const QString s_servicePath = QStringLiteral("/org/freedesktop/NetworkManager/VPN/Plugin");
+static const QString s_diagnosticsInterface = QStringLiteral("org.freedesktop.NetworkManager.pulse-sso.Diagnostics");
+
+// Per-connection transport overrides. An absent key means "use the NixOS
+// default" from /etc/nm-pulse-sso/config; the service reads the same keys.
+static const QString s_keyDtls = QStringLiteral("dtls");
+static const QString s_keyMtu = QStringLiteral("mtu");
+static const QString s_keyKeepalive = QStringLiteral("tcp-keepalive");
+static const QString s_keyKeepaliveInterval = QStringLiteral("tcp-keepalive-interval");
+
+// IPv4 minimum; openconnect rejects smaller tunnel MTUs
+static const int s_minMtu = 576;
+
+// Combo rows shared by the DTLS and keepalive selectors
+enum TristateIndex {
+    TristateDefault = 0,
+    TristateEnabled,
+    TristateDisabled,
+};
+
+static int tristateIndex(const QString &value)
+{
+    if (value == QLatin1String("yes")) {
+        return TristateEnabled;
+    }
+    if (value == QLatin1String("no")) {
+        return TristateDisabled;
+    }
+    return TristateDefault;
+}
+
+static void insertTristate(NMStringMap &data, const QString &key, int index)
+{
+    if (index == TristateEnabled) {
+        data.insert(key, QStringLiteral("yes"));
+    } else if (index == TristateDisabled) {
+        data.insert(key, QStringLiteral("no"));
+    }
+}
+
 PulseSsoSettingWidget::PulseSsoSettingWidget(const NetworkManager::VpnSetting::Ptr &setting, QWidget *parent)
     : SettingWidget(setting, parent)
     , m_ui(new Ui::PulseSsoWidget)
@@ -18,10 +72,37 @@ PulseSsoSettingWidget::PulseSsoSettingWidget(const NetworkManager::VpnSetting::P
 {
     m_ui->setupUi(this);
 
+    connect(m_ui->keepaliveCombo, &QComboBox::currentIndexChanged, this, [this](int index) {
+        m_ui->keepaliveIntervalSpinBox->setEnabled(index == TristateEnabled);
+    });
+    m_ui->keepaliveIntervalSpinBox->setEnabled(false);
+    connect(m_ui->mtuSpinBox, &QSpinBox::valueChanged, this, &PulseSsoSettingWidget::slotWidgetChanged);
+
     // Load initial configuration
     if (setting && !setting->isNull()) {
         loadConfig(setting);
     }
+
+    watchChangedSetting();
+
+    QDBusConnection bus = QDBusConnection::systemBus();
+    bus.connect(s_serviceName,
+                s_servicePath,
+                s_diagnosticsInterface,
+                QStringLiteral("DiagnosticsChanged"),
+                this,
+                SLOT(onDiagnosticsChanged(QVariantMap)));
+
+    // One initial snapshot; fails quietly when the service isn't running
+    QDBusMessage call = QDBusMessage::createMethodCall(s_serviceName, s_servicePath, s_diagnosticsInterface, QStringLiteral("GetDiagnostics"));
+    auto watcher = new QDBusPendingCallWatcher(bus.asyncCall(call), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [this](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<QVariantMap> reply = *watcher;
+        if (reply.isValid()) {
+            showDiagnostics(reply.value());
+        }
+        watcher->deleteLater();
+    });
 }
 
 PulseSsoSettingWidget::~PulseSsoSettingWidget()
@@ -40,6 +121,11 @@ void PulseSsoSettingWidget::loadConfig(const NetworkManager::Setting::Ptr &setti
     const QString gateway = data.value(QStringLiteral("gateway"));
 
     m_ui->gatewayLabel->setText(gateway.isEmpty() ? QStringLiteral("(not configured)") : gateway);
+
+    m_ui->dtlsCombo->setCurrentIndex(tristateIndex(data.value(s_keyDtls)));
+    m_ui->mtuSpinBox->setValue(data.value(s_keyMtu).toInt());
+    m_ui->keepaliveCombo->setCurrentIndex(tristateIndex(data.value(s_keyKeepalive)));
+    m_ui->keepaliveIntervalSpinBox->setValue(data.value(s_keyKeepaliveInterval).toInt());
 }
 
 void PulseSsoSettingWidget::loadSecrets(const NetworkManager::Setting::Ptr &setting)
@@ -62,6 +148,15 @@ QVariantMap PulseSsoSettingWidget::setting() const
         data.insert(QStringLiteral("gateway"), gateway);
     }
 
+    insertTristate(data, s_keyDtls, m_ui->dtlsCombo->currentIndex());
+    if (m_ui->mtuSpinBox->value() > 0) {
+        data.insert(s_keyMtu, QString::number(m_ui->mtuSpinBox->value()));
+    }
+    insertTristate(data, s_keyKeepalive, m_ui->keepaliveCombo->currentIndex());
+    if (m_ui->keepaliveCombo->currentIndex() == TristateEnabled && m_ui->keepaliveIntervalSpinBox->value() > 0) {
+        data.insert(s_keyKeepaliveInterval, QString::number(m_ui->keepaliveIntervalSpinBox->value()));
+    }
+
     setting.setData(data);
 
     return setting.toMap();
@@ -71,5 +166,76 @@ bool PulseSsoSettingWidget::isValid() const
 {
     // Connection is valid if we have a gateway configured
     const QString gateway = m_ui->gatewayLabel->text();
-    return !gateway.isEmpty() && gateway != QStringLiteral("(not configured)");
+    if (gateway.isEmpty() || gateway == QStringLiteral("(not configured)")) {
+        return false;
+    }
+    // 0 is "system default"; anything else must be a usable tunnel MTU
+    const int mtu = m_ui->mtuSpinBox->value();
+    return mtu == 0 || mtu >= s_minMtu;
+}
+
+void PulseSsoSettingWidget::onDiagnosticsChanged(const QVariantMap &diagnostics)
+{
+    showDiagnostics(diagnostics);
+}
+
+void PulseSsoSettingWidget::showDiagnostics(const QVariantMap &diagnostics)
+{
+    const QString none = QStringLiteral("–");
+    const KFormat format;
+
+    const int totalMs = diagnostics.value(QStringLiteral("auth_total_ms"), -1).toInt();
+    m_ui->authDurationLabel->setText(totalMs < 0 ? none : format.formatDuration(totalMs));
+
+    // Phase marks are milliseconds since launch, so sorting by value restores their order
+    const QJsonObject phaseObject = QJsonDocument::fromJson(diagnostics.value(QStringLiteral("auth_phases")).toString().toUtf8()).object();
+    QList<QPair<qint64, QString>> phases;
+    for (auto it = phaseObject.constBegin(); it != phaseObject.constEnd(); ++it) {
+        phases.append(qMakePair(static_cast<qint64>(it.value().toDouble()), it.key()));
+    }
+    std::sort(phases.begin(), phases.end());
+    QStringList phaseLines;
+    for (const auto &phase : std::as_const(phases)) {
+        phaseLines.append(i18nc("auth phase name and time since launch", "%1: %2", phase.second, format.formatDuration(phase.first)));
+    }
+    m_ui->authPhasesLabel->setText(phaseLines.isEmpty() ? none : phaseLines.join(QLatin1Char('\n')));
+
+    const QString method = diagnostics.value(QStringLiteral("auth_method")).toString();
+    if (method == QLatin1String("cef")) {
+        m_ui->authMethodLabel->setText(i18n("Embedded browser"));
+    } else if (method == QLatin1String("cef-daemon")) {
+        m_ui->authMethodLabel->setText(i18n("Embedded browser (pre-warmed)"));
+    } else if (method == QLatin1String("revalidated")) {
+        m_ui->authMethodLabel->setText(i18n("Previous session reused"));
+    } else if (method == QLatin1String("browser-proxy")) {
+        m_ui->authMethodLabel->setText(i18n("System browser via local proxy"));
+    } else if (method == QLatin1String("race-cef")) {
+        m_ui->authMethodLabel->setText(i18n("Embedded browser (won race against local proxy)"));
+    } else if (method == QLatin1String("race-proxy")) {
+        m_ui->authMethodLabel->setText(i18n("Local proxy (won race against embedded browser)"));
+    } else if (method == QLatin1String("plasma-webengine")) {
+        m_ui->authMethodLabel->setText(i18n("Plasma sign-in dialog"));
+    } else if (method == QLatin1String("selenium")) {
+        m_ui->authMethodLabel->setText(i18n("Selenium-driven browser"));
+    } else {
+        m_ui->authMethodLabel->setText(method.isEmpty() ? none : method);
+    }
+
+    m_ui->reconnectsLabel->setText(QString::number(diagnostics.value(QStringLiteral("reconnects")).toUInt()));
+
+    const QString transport = diagnostics.value(QStringLiteral("transport")).toString();
+    m_ui->transportLabel->setText(transport.isEmpty() ? i18n("Not connected") : transport);
+
+    const uint mtu = diagnostics.value(QStringLiteral("mtu")).toUInt();
+    m_ui->mtuLabel->setText(mtu == 0 ? none : QString::number(mtu));
+
+    const QString tundev = diagnostics.value(QStringLiteral("tundev")).toString();
+    if (tundev.isEmpty()) {
+        m_ui->trafficLabel->setText(none);
+    } else {
+        m_ui->trafficLabel->setText(i18n("%1 received, %2 sent (%3)",
+                                         format.formatByteSize(diagnostics.value(QStringLiteral("rx_bytes")).toULongLong()),
+                                         format.formatByteSize(diagnostics.value(QStringLiteral("tx_bytes")).toULongLong()),
+                                         tundev));
+    }
 }
@@ -30,7 +30,12 @@ public:
     QVariantMap setting() const override;
     bool isValid() const override;
 
+private Q_SLOTS:
+    void onDiagnosticsChanged(const QVariantMap &diagnostics);
+
 private:
+    void showDiagnostics(const QVariantMap &diagnostics);
+
     Ui::PulseSsoWidget *m_ui;
     NetworkManager::VpnSetting::Ptr m_setting;
 };
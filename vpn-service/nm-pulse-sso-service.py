@@ -15,6 +15,7 @@ Browser authentication is handled by the auth-dialog (pulse-sso-auth-dialog)
 which NetworkManager runs as the user BEFORE calling Connect().
 """
 
+import json
 import logging
 import os
 import pwd
@@ -43,6 +44,8 @@ from gi.repository import GLib
 NM_DBUS_SERVICE = "org.freedesktop.NetworkManager.pulse-sso"
 NM_DBUS_INTERFACE = "org.freedesktop.NetworkManager.VPN.Plugin"
 NM_DBUS_PATH = "/org/freedesktop/NetworkManager/VPN/Plugin"
+# Read-only diagnostics for the Plasma settings widget, on the same object
+DIAG_DBUS_INTERFACE = "org.freedesktop.NetworkManager.pulse-sso.Diagnostics"
 
 # Config file written by NixOS
 CONFIG_PATH = Path("/etc/nm-pulse-sso/config")
@@ -115,6 +118,130 @@ def get_tcp_keepalive_config() -> tuple:
     return enabled, interval
 
 
+def _parse_vpn_data_bool(value: str) -> "bool | None":
+    """'yes'/'no' from a VpnSetting data field; None when unset or unknown."""
+    value = (value or "").strip().lower()
+    if value in ("yes", "true"):
+        return True
+    if value in ("no", "false"):
+        return False
+    return None
+
+
+def _parse_vpn_data_int(value: str, minimum: int) -> "int | None":
+    """Integer VpnSetting data field; None when unset or below minimum."""
+    try:
+        parsed = int((value or "").strip())
+    except ValueError:
+        return None
+    return parsed if parsed >= minimum else None
+
+
+def get_transport_settings(vpn_data: dict) -> dict:
+    """
+    Resolve DTLS, MTU and TCP keepalive for one connection.
+
+    The Plasma settings widget stores per-connection overrides as VpnSetting
+    data ("dtls", "mtu", "tcp-keepalive", "tcp-keepalive-interval"). Each key
+    that is present and valid wins; the rest fall back to the NixOS config.
+    """
+    keepalive_enabled, keepalive_interval = get_tcp_keepalive_config()
+    settings = {
+        "dtls": is_dtls_enabled(),
+        "mtu": get_vpn_mtu(),
+        "keepalive": keepalive_enabled,
+        "keepalive_interval": keepalive_interval,
+    }
+
+    dtls = _parse_vpn_data_bool(vpn_data.get("dtls", ""))
+    if dtls is not None:
+        settings["dtls"] = dtls
+    mtu = _parse_vpn_data_int(vpn_data.get("mtu", ""), 576)
+    if mtu is not None:
+        settings["mtu"] = mtu
+    keepalive = _parse_vpn_data_bool(vpn_data.get("tcp-keepalive", ""))
+    if keepalive is not None:
+        settings["keepalive"] = keepalive
+    interval = _parse_vpn_data_int(vpn_data.get("tcp-keepalive-interval", ""), 1)
+    if interval is not None:
+        settings["keepalive_interval"] = interval
+    return settings
+
+
+_openconnect_keepalive_support: "bool | None" = None
+
+
+def openconnect_supports_keepalive() -> bool:
+    """
+    Whether this openconnect has the --keepalive patch.
+
+    The NixOS module only patches openconnect when enableTcpKeepalive is set,
+    so a per-connection override can ask for an option the binary lacks.
+    """
+    global _openconnect_keepalive_support
+    if _openconnect_keepalive_support is None:
+        try:
+            out = subprocess.run(
+                ["openconnect", "--help"], capture_output=True, text=True, timeout=5
+            )
+            _openconnect_keepalive_support = "--keepalive" in (out.stdout + out.stderr)
+        except (OSError, subprocess.SubprocessError):
+            _openconnect_keepalive_support = False
+    return _openconnect_keepalive_support
+
+
+def is_auth_prewarm_enabled() -> bool:
+    """
+    Check if the pre-warmed CEF auth daemon is enabled in the NixOS config.
+
+    When enabled, the service starts `pulse-browser-auth --daemon` in the
+    user's session on resume, so the next auth skips the CEF cold start.
+    """
+    try:
+        if CONFIG_PATH.exists():
+            content = CONFIG_PATH.read_text()
+            for line in content.splitlines():
+                line = line.strip()
+                if line.startswith("PREWARM_AUTH_BROWSER="):
+                    value = line.split("=", 1)[1].strip().lower()
+                    return value == "true"
+    except Exception as e:
+        logger.warning("Failed to read auth prewarm config: %s", e)
+    return False
+
+
+def is_plasma_agent_auth_enabled() -> bool:
+    """
+    Check if logins should go through the Plasma secrets agent.
+
+    When enabled, NeedSecrets asks NetworkManager for the cookie instead of
+    returning '', so plasma-nm shows the plugin's in-process login (askUser)
+    and the service never spawns its own browser for the first connect.
+    """
+    try:
+        if CONFIG_PATH.exists():
+            content = CONFIG_PATH.read_text()
+            for line in content.splitlines():
+                line = line.strip()
+                if line.startswith("PLASMA_INPROCESS_AUTH="):
+                    value = line.split("=", 1)[1].strip().lower()
+                    return value == "true"
+    except Exception as e:
+        logger.warning("Failed to read Plasma auth config: %s", e)
+    return False
+
+
+# Transient user unit that hosts the pre-warmed CEF auth daemon. Fixed name so
+# a second prewarm is a no-op and _kill_auth_dialog() can spare its processes.
+AUTH_DAEMON_UNIT = "pulse-browser-auth-daemon.service"
+
+# One-shot request to trace the next CEF login: `touch` it as root and the
+# next auth-dialog launch gets AUTH_TRACE_ENV pointing into the user's
+# runtime dir, where cef-pulse-auth writes a Chromium trace of the flow.
+AUTH_TRACE_TRIGGER = Path("/run/nm-pulse-sso/trace-next-auth")
+AUTH_TRACE_ENV = "PULSE_AUTH_TRACE_FILE"
+
+
 # Setup logging
 logging.basicConfig(
     level=logging.INFO, format="%(asctime)s - %(name)s - %(levelname)s - %(message)s"
@@ -219,12 +346,20 @@ class PulseSSOPlugin(dbus.service.Object):
         self.gateway: Optional[str] = None
         self.cookie: Optional[str] = None
         self.servercert: Optional[str] = None
+        # "pin-sha256:..." SPKI pin of the gateway cert, reported by the CEF
+        # auth browser from the TLS connection it authenticated over. Unlike
+        # servercert (full-DER sha256) this is a format openconnect's
+        # --servercert accepts.
+        self.servercert_pin: Optional[str] = None
         # Optional "HOST:IP" override for openconnect's --resolve. Set by the
         # browser-auth backend (proxy.py resolves the gateway via DoH while
         # building the MITM cert chain) so openconnect can dial the real IP
         # directly without going through the /etc/hosts loopback redirect
         # that we install for the browser. Always None for the CEF backend.
         self.resolve: Optional[str] = None
+        # VpnSetting data of the active connection; carries the per-connection
+        # transport overrides (see get_transport_settings)
+        self.vpn_data: dict = {}
 
         # Pending connection for interactive flow
         self.pending_connection: Optional[dict] = None
@@ -298,6 +433,34 @@ class PulseSSOPlugin(dbus.service.Object):
         self._auth_dialog_child_watch_id: Optional[int] = None
         self._auth_dialog_timeout_id: Optional[int] = None
 
+        # total_ms of recent successful CEF auth runs (METRICS records relayed
+        # by the auth-dialog), used to log a rolling median next to each run
+        self._auth_timings: list = []
+
+        # (gateway, cookie) last handed to openconnect and not rejected with
+        # exit code 2. Survives the state resets of a transport restart or
+        # NM reactivation, so the next auth-dialog run can first ask the
+        # browser to --revalidate it (one HTTPS request) before opening the
+        # full SSO flow.
+        self._revalidate_candidate: Optional[tuple] = None
+
+        # Snapshot pushed to the Plasma widget via DiagnosticsChanged (and
+        # returned by GetDiagnostics when it opens). Tunnel byte counters are
+        # refreshed every DIAG_TRAFFIC_INTERVAL seconds while connected.
+        self._diag = {
+            "auth_total_ms": -1,
+            "auth_phases": "",      # JSON object, phase -> ms since start
+            "auth_method": "",
+            "reconnects": 0,
+            "transport": "",
+            "mtu": 0,
+            "tundev": "",
+            "rx_bytes": 0,
+            "tx_bytes": 0,
+        }
+        self._diag_connects = 0
+        self._diag_traffic_id: Optional[int] = None
+
         # Transient unit name and target user for the active auth-dialog
         # systemd-run invocation. Set when launching, used to explicitly stop
         # the unit on disconnect — systemd's stop tears down the cgroup
@@ -346,6 +509,10 @@ class PulseSSOPlugin(dbus.service.Object):
         # Timestamp of last resume from suspend — used for stabilization delay
         self._resume_timestamp: float = 0
 
+        # Pending GLib timer that starts the pre-warmed CEF auth daemon after
+        # resume (see _prewarm_auth_daemon).
+        self._prewarm_timeout_id: Optional[int] = None
+
         # Monotonic timestamp of the most recent StateChanged(Starting) emission.
         # NM's state machine sometimes fires Disconnect() within ~hundreds of ms
         # of a Starting emission; the timestamp lets Disconnect() distinguish
@@ -415,6 +582,62 @@ class PulseSSOPlugin(dbus.service.Object):
             logger.info(
                 "PrepareForSleep: system resuming — auth-dialog launch re-enabled"
             )
+            # Warm up CEF while the network settles, so the reconnect's auth
+            # request skips the browser cold start. Same 8s stabilization
+            # delay as _launch_direct_auth().
+            if is_auth_prewarm_enabled() and self._prewarm_timeout_id is None:
+                self._prewarm_timeout_id = GLib.timeout_add(
+                    8000, self._prewarm_auth_daemon
+                )
+
+    def _prewarm_auth_daemon(self) -> bool:
+        """
+        Start the pre-warmed CEF auth daemon in the user's graphical session.
+
+        Runs `pulse-sso-auth-dialog --prewarm` in its own transient user unit;
+        the auth-dialog execs `pulse-browser-auth --daemon`, which then serves
+        the auth-dialog's later AUTH request over its UNIX socket. A second
+        call while the unit is still running fails harmlessly.
+
+        Returns False to prevent GLib timeout from repeating.
+        """
+        self._prewarm_timeout_id = None
+        if self._suspending:
+            return False
+
+        try:
+            session = self._find_graphical_session()
+        except Exception as e:
+            logger.debug("Auth daemon prewarm: session lookup failed: %s", e)
+            return False
+        if not session:
+            logger.debug("Auth daemon prewarm: no graphical session")
+            return False
+
+        cmd = [
+            "systemd-run",
+            "--user",
+            f"--machine={session['user']}@",
+            f"--unit={AUTH_DAEMON_UNIT}",
+            "--collect",
+            "--quiet",
+            *self._session_env_args(session),
+            "--",
+            self._auth_dialog_path(),
+            "--prewarm",
+        ]
+        try:
+            result = subprocess.run(cmd, capture_output=True, text=True, timeout=10)
+            if result.returncode == 0:
+                logger.info("Started pre-warmed CEF auth daemon for %s", session["user"])
+            else:
+                logger.debug(
+                    "Auth daemon prewarm rc=%d (already running?): %s",
+                    result.returncode, result.stderr.strip(),
+                )
+        except Exception as e:
+            logger.debug("Auth daemon prewarm failed (non-fatal): %s", e)
+        return False
 
     def _send_user_notification(self, title: str, message: str, icon: str = "network-vpn"):
         """Send a desktop notification to all logged-in users.
@@ -468,9 +691,12 @@ class PulseSSOPlugin(dbus.service.Object):
             vpn_secrets = connection.get("vpn", {}).get("secrets", {})
             cookie = vpn_secrets.get("cookie", "")
             servercert = vpn_secrets.get("gwcert", "")
+            servercert_pin = vpn_secrets.get("gwpin", "")
             # Optional "HOST:IP" override for the browser-auth backend; see
             # __init__ for why we need it.
             resolve = vpn_secrets.get("resolve", "")
+            # Set by the Plasma plugin's in-process login
+            auth_method = vpn_secrets.get("authmethod", "")
 
             if not gateway:
                 raise LaunchFailedError("No gateway specified in VPN configuration")
@@ -490,7 +716,10 @@ class PulseSSOPlugin(dbus.service.Object):
             self.gateway = gateway
             self.cookie = cookie
             self.servercert = servercert
+            self.servercert_pin = servercert_pin or None
             self.resolve = resolve or None
+            if auth_method:
+                self._diag["auth_method"] = auth_method
 
             # Reset disconnect flag - we're starting a new connection
             self._disconnect_requested = False
@@ -628,8 +857,10 @@ class PulseSSOPlugin(dbus.service.Object):
         # - With DTLS disabled: --no-dtls forces SSL-only mode (TCP only).
         # - With DTLS enabled: uses ESP/UDP for better performance.
         # Reconnection is handled externally by vpn-auto-reconnect service via nmcli.
-        dtls_enabled = is_dtls_enabled()
+        transport = get_transport_settings(self.vpn_data)
+        dtls_enabled = transport["dtls"]
         logger.info("DTLS/ESP mode: %s", "enabled" if dtls_enabled else "disabled")
+        self._diag["transport"] = "TLS (ESP pending)" if dtls_enabled else "TLS only"
 
         cmd = [
             "openconnect",
@@ -640,7 +871,14 @@ class PulseSSOPlugin(dbus.service.Object):
             cmd.append("--no-dtls")
 
         # TCP keepalive handling
-        keepalive_enabled, keepalive_interval = get_tcp_keepalive_config()
+        keepalive_enabled = transport["keepalive"]
+        keepalive_interval = transport["keepalive_interval"]
+        if keepalive_enabled and not openconnect_supports_keepalive():
+            logger.warning(
+                "TCP keepalive requested but openconnect lacks --keepalive "
+                "(enable enableTcpKeepalive in NixOS to patch it); skipping"
+            )
+            keepalive_enabled = False
         if keepalive_enabled:
             if keepalive_interval is not None:
                 cmd.append(f"--keepalive={keepalive_interval}")
@@ -651,7 +889,7 @@ class PulseSSOPlugin(dbus.service.Object):
                 keepalive_interval if keepalive_interval else "system default",
             )
 
-        vpn_mtu = get_vpn_mtu()
+        vpn_mtu = transport["mtu"]
         if vpn_mtu is not None:
             cmd.append(f"--mtu={vpn_mtu}")
             logger.info("VPN MTU override: %d", vpn_mtu)
@@ -670,6 +908,12 @@ class PulseSSOPlugin(dbus.service.Object):
         # the original SNI hostname (pcs.flxvpn.net), not the IP we resolved
         # to. self.servercert is still kept in memory / NM secrets for
         # diagnostic logging.
+        #
+        # The CEF auth browser does report an SPKI pin (gwpin) taken from the
+        # TLS session it authenticated over; when we have one, pass it so
+        # openconnect accepts that exact cert without a separate check.
+        if self.servercert_pin:
+            cmd.append(f"--servercert={self.servercert_pin}")
         if self.resolve:
             cmd.append(f"--resolve={self.resolve}")
             logger.info("openconnect --resolve=%s", self.resolve)
@@ -693,6 +937,10 @@ class PulseSSOPlugin(dbus.service.Object):
         # Set environment for helper script to find our D-Bus service
         env = os.environ.copy()
         env["NM_DBUS_SERVICE_PULSE_SSO"] = NM_DBUS_SERVICE
+        # The helper caps INTERNAL_IP4_MTU at this; it may be a per-connection
+        # value rather than the config file's VPN_MTU
+        if vpn_mtu is not None:
+            env["PULSE_SSO_VPN_MTU"] = str(vpn_mtu)
 
         # Redirect stdin to avoid blocking. Capture stderr into a pipe so we
         # can drain it on a thread and forward each line through the Python
@@ -710,6 +958,7 @@ class PulseSSOPlugin(dbus.service.Object):
             stdout=subprocess.DEVNULL,
             stderr=subprocess.PIPE,
         )
+        self._revalidate_candidate = (self.gateway, self.cookie)
         # New process — tunnel not yet up. Arms the post-Starting Disconnect
         # quirk window in Disconnect(); cleared in SetIp4Config on success.
         self._openconnect_connected = False
@@ -732,6 +981,18 @@ class PulseSSOPlugin(dbus.service.Object):
                     tail.append(line)
                     logger.info("openconnect: %s", line)
 
+                    transport = None
+                    if "ESP session established" in line:
+                        transport = "ESP (UDP)"
+                    elif "DTLS connected" in line or "Established DTLS connection" in line:
+                        transport = "DTLS (UDP)"
+                    elif "detected dead peer" in line:
+                        transport = "TLS (UDP down)"
+                    if transport:
+                        proc = self.proc
+                        GLib.idle_add(self._set_transport, transport,
+                                      proc.pid if proc is not None else -1)
+
                     # Dead-transport watchdog: when the gateway is unroutable
                     # (e.g. an interface migration that produced no NM
                     # dispatcher 'down' event — wifi roam, dock swap with no
@@ -780,6 +1041,7 @@ class PulseSSOPlugin(dbus.service.Object):
         ).start()
 
         logger.info("openconnect started with PID %d", self.proc.pid)
+        self._emit_diagnostics()
 
         # Write early grace period timestamp so the dispatcher won't kill
         # a just-spawned openconnect.  Updated again in SetIp4Config with
@@ -796,6 +1058,18 @@ class PulseSSOPlugin(dbus.service.Object):
             self.proc.pid, self._on_openconnect_exit
         )
 
+    def _set_transport(self, transport: str, pid: int) -> bool:
+        """Main-loop handler: _drain_stderr saw openconnect's transport change.
+
+        Ignored if that openconnect has been replaced meanwhile. Returns False
+        so the GLib.idle_add callback does not repeat.
+        """
+        if (self.proc is not None and self.proc.pid == pid
+                and transport != self._diag["transport"]):
+            self._diag["transport"] = transport
+            self._emit_diagnostics()
+        return False
+
     def _restart_dead_transport(self, pid: int) -> bool:
         """Main-loop handler: openconnect's transport is persistently dead.
 
@@ -882,6 +1156,8 @@ class PulseSSOPlugin(dbus.service.Object):
             exit_code = status
 
         logger.info("openconnect (PID %d) exited with code %d", pid, exit_code)
+        self._diag["transport"] = ""
+        self._emit_diagnostics()
 
         # If openconnect bailed fast (< 1s), the stderr drain thread may have
         # already logged lines but they can be hard to find in the firehose.
@@ -917,6 +1193,7 @@ class PulseSSOPlugin(dbus.service.Object):
             )
             self.cookie = None
             self._cookie_is_fresh = False
+            self._revalidate_candidate = None
             if self.gateway and not self._disconnect_requested:
                 if not was_fresh:
                     # Stale cookie rejected — expected after rebuild/resume.
@@ -986,6 +1263,7 @@ class PulseSSOPlugin(dbus.service.Object):
                     self.cookie = None
                     self.resolve = None
                     self.servercert = None
+                    self.servercert_pin = None
                     self._cookie_is_fresh = False
                     if self.gateway and not self._disconnect_requested:
                         self._reconnection_pending = True
@@ -1283,23 +1561,36 @@ class PulseSSOPlugin(dbus.service.Object):
         # Layer 3 — SIGKILL by name. Catches stragglers including stale
         # CEF processes from a previous run that were never reaped. Logs
         # what was killed so we can see at runtime whether the pattern
-        # actually matches.
+        # actually matches. Processes of the pre-warmed auth daemon unit
+        # are spared: the daemon cancels its own window when the auth-dialog
+        # connection drops.
         for pattern in ("pulse-sso-auth-dialog", "pulse-browser-auth"):
             try:
                 result = subprocess.run(
-                    ["pkill", "-KILL", "-echo", "-f", pattern],
+                    ["pgrep", "-a", "-f", pattern],
                     capture_output=True, text=True, timeout=2,
                 )
-                if result.returncode == 0:
-                    killed = result.stdout.strip().replace("\n", "; ")
-                    logger.info("pkill -f %s killed: %s", pattern, killed)
-                elif result.returncode == 1:
-                    logger.debug("pkill -f %s: no matches", pattern)
-                else:
+                if result.returncode == 1:
+                    logger.debug("pgrep -f %s: no matches", pattern)
+                    continue
+                if result.returncode != 0:
                     logger.warning(
-                        "pkill -f %s rc=%d stderr=%s",
+                        "pgrep -f %s rc=%d stderr=%s",
                         pattern, result.returncode, result.stderr.strip(),
                     )
+                    continue
+                killed = []
+                for entry in result.stdout.strip().splitlines():
+                    pid_str, _, cmdline = entry.partition(" ")
+                    if not pid_str.isdigit() or self._in_auth_daemon_unit(int(pid_str)):
+                        continue
+                    try:
+                        os.kill(int(pid_str), signal.SIGKILL)
+                        killed.append(f"{cmdline} (pid {pid_str})")
+                    except OSError:
+                        pass
+                if killed:
+                    logger.info("SIGKILL -f %s killed: %s", pattern, "; ".join(killed))
             except Exception as e:
                 logger.debug("pkill %s failed (non-fatal): %s", pattern, e)
 
@@ -1310,6 +1601,15 @@ class PulseSSOPlugin(dbus.service.Object):
         # Tear down the per-session proxy NAT redirect, if any.
         self._clear_proxy_nat()
 
+    @staticmethod
+    def _in_auth_daemon_unit(pid: int) -> bool:
+        """True if pid belongs to the pre-warmed CEF auth daemon's cgroup."""
+        try:
+            with open(f"/proc/{pid}/cgroup") as f:
+                return AUTH_DAEMON_UNIT in f.read()
+        except OSError:
+            return False
+
     # --- browser-auth proxy NAT redirect (per-session, ephemeral port) -----
     #
     # The browser reaches the local MITM proxy through an iptables NAT rule
@@ -1417,6 +1717,179 @@ class PulseSSOPlugin(dbus.service.Object):
         self._last_starting_ts = time.monotonic()
         self.StateChanged(ServiceState.Starting)
 
+    def _find_graphical_session(self) -> "Optional[dict]":
+        """
+        Locate the active graphical login session and its environment.
+
+        Returns a dict (user, uid, user_home, session_type, display,
+        runtime_dir, dbus_addr, wayland_display, xauthority) suitable for
+        _session_env_args(), or None if no x11/wayland session exists.
+        """
+        # Find graphical session via loginctl
+        result = subprocess.run(
+            ["loginctl", "list-sessions", "--no-legend"],
+            capture_output=True,
+            text=True,
+            timeout=5,
+        )
+
+        user = None
+        session_type = None
+        session_leader = None
+        display = ":0"
+
+        for line in result.stdout.strip().split("\n"):
+            if not line.strip():
+                continue
+            parts = line.split()
+            if len(parts) >= 1:
+                session_id = parts[0]
+                # Get session properties
+                # Note: --property=A,B,C syntax doesn't work, must use separate flags
+                show = subprocess.run(
+                    [
+                        "loginctl",
+                        "show-session",
+                        session_id,
+                        "--property=Name",
+                        "--property=Type",
+                        "--property=Display",
+                        "--property=Leader",
+                    ],
+                    capture_output=True,
+                    text=True,
+                    timeout=5,
+                )
+                props = {}
+                for prop_line in show.stdout.strip().split("\n"):
+                    if "=" in prop_line:
+                        k, v = prop_line.split("=", 1)
+                        props[k] = v
+
+                # Look for graphical session (x11 or wayland)
+                if props.get("Type") in ("x11", "wayland"):
+                    user = props.get("Name")
+                    session_type = props.get("Type")
+                    session_leader = props.get("Leader")
+                    display = props.get("Display") or ":0"
+                    logger.debug(
+                        "Found graphical session: user=%s, type=%s, display=%s, leader=%s",
+                        user,
+                        session_type,
+                        display,
+                        session_leader,
+                    )
+                    break
+
+        if not user:
+            return None
+
+        # Get UID for environment wiring
+        uid = pwd.getpwnam(user).pw_uid
+        user_home = pwd.getpwnam(user).pw_dir
+
+        # Default environment values for graphical auth
+        runtime_dir = f"/run/user/{uid}"
+        dbus_addr = f"unix:path={runtime_dir}/bus"
+
+        wayland_display = None
+        xauthority = None
+
+        # Try to inherit graphical-session env from the session leader
+        if session_leader and session_leader.isdigit():
+            environ_path = f"/proc/{session_leader}/environ"
+            try:
+                with open(environ_path, "rb") as f:
+                    raw_env = f.read()
+                env_map = {}
+                for entry in raw_env.split(b"\0"):
+                    if not entry or b"=" not in entry:
+                        continue
+                    k, v = entry.split(b"=", 1)
+                    env_map[k.decode(errors="ignore")] = v.decode(errors="ignore")
+
+                display = env_map.get("DISPLAY", display)
+                runtime_dir = env_map.get("XDG_RUNTIME_DIR", runtime_dir)
+                dbus_addr = env_map.get(
+                    "DBUS_SESSION_BUS_ADDRESS", f"unix:path={runtime_dir}/bus"
+                )
+                wayland_display = env_map.get("WAYLAND_DISPLAY")
+                xauthority = env_map.get("XAUTHORITY")
+            except Exception as e:
+                logger.debug(
+                    "Could not read session leader environment (%s): %s",
+                    environ_path,
+                    e,
+                )
+
+        # If we are in a Wayland session and DISPLAY is absent/invalid,
+        # prefer native Wayland socket discovery over forcing :0.
+        if session_type == "wayland":
+            if not wayland_display:
+                try:
+                    for name in os.listdir(runtime_dir):
+                        if name.startswith("wayland-"):
+                            wayland_display = name
+                            break
+                except Exception:
+                    pass
+
+            if display == ":0":
+                display = ""
+
+        return {
+            "user": user,
+            "uid": uid,
+            "user_home": user_home,
+            "session_type": session_type,
+            "display": display,
+            "runtime_dir": runtime_dir,
+            "dbus_addr": dbus_addr,
+            "wayland_display": wayland_display,
+            "xauthority": xauthority,
+        }
+
+    @staticmethod
+    def _session_env_args(session: dict) -> list:
+        """systemd-run --setenv arguments for a _find_graphical_session() result."""
+        env_args = [
+            f"--setenv=HOME={session['user_home']}",
+            f"--setenv=XDG_RUNTIME_DIR={session['runtime_dir']}",
+            f"--setenv=DBUS_SESSION_BUS_ADDRESS={session['dbus_addr']}",
+        ]
+        if session["display"]:
+            env_args.append(f"--setenv=DISPLAY={session['display']}")
+        if session["session_type"]:
+            env_args.append(f"--setenv=XDG_SESSION_TYPE={session['session_type']}")
+        if session["wayland_display"]:
+            env_args.append(f"--setenv=WAYLAND_DISPLAY={session['wayland_display']}")
+            env_args.append("--setenv=OZONE_PLATFORM=wayland")
+        if session["xauthority"]:
+            env_args.append(f"--setenv=XAUTHORITY={session['xauthority']}")
+        return env_args
+
+    @staticmethod
+    def _consume_auth_trace_request(session: dict) -> "str | None":
+        """Trace file for this auth attempt if AUTH_TRACE_TRIGGER was set; clears it."""
+        try:
+            AUTH_TRACE_TRIGGER.unlink()
+        except FileNotFoundError:
+            return None
+        except OSError as e:
+            logger.warning("Cannot clear %s, not tracing: %s", AUTH_TRACE_TRIGGER, e)
+            return None
+        trace_file = os.path.join(
+            session["runtime_dir"], f"pulse-auth-trace-{time.strftime('%Y%m%d-%H%M%S')}.json"
+        )
+        logger.info("Tracing this auth attempt to %s", trace_file)
+        return trace_file
+
+    def _auth_dialog_path(self) -> str:
+        """Derive auth-dialog path from helper_script (same directory)."""
+        return self.helper_script.replace(
+            "nm-pulse-sso-helper", "pulse-sso-auth-dialog"
+        )
+
     def _launch_direct_auth(self) -> bool:
         """
         Launch auth-dialog directly, bypassing NM's agent system.
@@ -1534,74 +2007,15 @@ class PulseSSOPlugin(dbus.service.Object):
         )
 
         try:
-            # Find graphical session via loginctl
-            result = subprocess.run(
-                ["loginctl", "list-sessions", "--no-legend"],
-                capture_output=True,
-                text=True,
-                timeout=5,
-            )
-
-            user = None
-            session_type = None
-            session_leader = None
-            display = ":0"
-
-            for line in result.stdout.strip().split("\n"):
-                if not line.strip():
-                    continue
-                parts = line.split()
-                if len(parts) >= 1:
-                    session_id = parts[0]
-                    # Get session properties
-                    # Note: --property=A,B,C syntax doesn't work, must use separate flags
-                    show = subprocess.run(
-                        [
-                            "loginctl",
-                            "show-session",
-                            session_id,
-                            "--property=Name",
-                            "--property=Type",
-                            "--property=Display",
-                            "--property=Leader",
-                        ],
-                        capture_output=True,
-                        text=True,
-                        timeout=5,
-                    )
-                    props = {}
-                    for prop_line in show.stdout.strip().split("\n"):
-                        if "=" in prop_line:
-                            k, v = prop_line.split("=", 1)
-                            props[k] = v
-
-                    # Look for graphical session (x11 or wayland)
-                    if props.get("Type") in ("x11", "wayland"):
-                        user = props.get("Name")
-                        session_type = props.get("Type")
-                        session_leader = props.get("Leader")
-                        display = props.get("Display") or ":0"
-                        logger.debug(
-                            "Found graphical session: user=%s, type=%s, display=%s, leader=%s",
-                            user,
-                            session_type,
-                            display,
-                            session_leader,
-                        )
-                        break
-
-            if not user:
+            session = self._find_graphical_session()
+            if not session:
                 logger.error("No graphical session found, will retry")
                 self._schedule_direct_auth(self._reconnection_retry_interval)
                 return False
-
-            # Get UID for environment wiring
-            uid = pwd.getpwnam(user).pw_uid
-            user_home = pwd.getpwnam(user).pw_dir
-
-            # Default environment values for graphical auth
+            user = session["user"]
+            uid = session["uid"]
+            display = session["display"]
             runtime_dir = f"/run/user/{uid}"
-            dbus_addr = f"unix:path={runtime_dir}/bus"
 
             # Quick health check: can we reach the user's D-Bus session bus?
             # After NM restart, systemd-run --machine=user@ fails with
@@ -1633,55 +2047,7 @@ class PulseSSOPlugin(dbus.service.Object):
                 )
                 self._schedule_direct_auth(3000)
                 return False
-            wayland_display = None
-            xauthority = None
-
-            # Try to inherit graphical-session env from the session leader
-            if session_leader and session_leader.isdigit():
-                environ_path = f"/proc/{session_leader}/environ"
-                try:
-                    with open(environ_path, "rb") as f:
-                        raw_env = f.read()
-                    env_map = {}
-                    for entry in raw_env.split(b"\0"):
-                        if not entry or b"=" not in entry:
-                            continue
-                        k, v = entry.split(b"=", 1)
-                        env_map[k.decode(errors="ignore")] = v.decode(errors="ignore")
-
-                    display = env_map.get("DISPLAY", display)
-                    runtime_dir = env_map.get("XDG_RUNTIME_DIR", runtime_dir)
-                    dbus_addr = env_map.get(
-                        "DBUS_SESSION_BUS_ADDRESS", f"unix:path={runtime_dir}/bus"
-                    )
-                    wayland_display = env_map.get("WAYLAND_DISPLAY")
-                    xauthority = env_map.get("XAUTHORITY")
-                except Exception as e:
-                    logger.debug(
-                        "Could not read session leader environment (%s): %s",
-                        environ_path,
-                        e,
-                    )
-
-            # If we are in a Wayland session and DISPLAY is absent/invalid,
-            # prefer native Wayland socket discovery over forcing :0.
-            if session_type == "wayland":
-                if not wayland_display:
-                    try:
-                        for name in os.listdir(runtime_dir):
-                            if name.startswith("wayland-"):
-                                wayland_display = name
-                                break
-                    except Exception:
-                        pass
-
-                if display == ":0":
-                    display = ""
-
-            # Derive auth-dialog path from helper_script (same directory)
-            auth_dialog = self.helper_script.replace(
-                "nm-pulse-sso-helper", "pulse-sso-auth-dialog"
-            )
+            auth_dialog = self._auth_dialog_path()
 
             # Pick a free ephemeral port for the MITM proxy this session and
             # install the loopback :443 -> :port NAT redirect at the TOP of
@@ -1698,20 +2064,10 @@ class PulseSSOPlugin(dbus.service.Object):
                 user, uid, display, proxy_port,
             )
 
-            env_args = [
-                f"--setenv=HOME={user_home}",
-                f"--setenv=XDG_RUNTIME_DIR={runtime_dir}",
-                f"--setenv=DBUS_SESSION_BUS_ADDRESS={dbus_addr}",
-            ]
-            if display:
-                env_args.append(f"--setenv=DISPLAY={display}")
-            if session_type:
-                env_args.append(f"--setenv=XDG_SESSION_TYPE={session_type}")
-            if wayland_display:
-                env_args.append(f"--setenv=WAYLAND_DISPLAY={wayland_display}")
-                env_args.append("--setenv=OZONE_PLATFORM=wayland")
-            if xauthority:
-                env_args.append(f"--setenv=XAUTHORITY={xauthority}")
+            env_args = self._session_env_args(session)
+            trace_file = self._consume_auth_trace_request(session)
+            if trace_file:
+                env_args.append(f"--setenv={AUTH_TRACE_ENV}={trace_file}")
 
             # Generate a deterministic transient-unit name for systemctl stop.
             # Each launch gets a fresh name so we can target only the current
@@ -1772,8 +2128,12 @@ class PulseSSOPlugin(dbus.service.Object):
             ]
             self._auth_launch_index = 0
 
-            # Auth-dialog protocol: send gateway via stdin
-            self._auth_input_data = f"DATA_KEY=gateway\nDATA_VAL={self.gateway}\nDONE\n".encode()
+            # Auth-dialog protocol: send gateway via stdin, plus the last
+            # unrejected cookie for this gateway to revalidate first
+            auth_input = f"DATA_KEY=gateway\nDATA_VAL={self.gateway}\n"
+            if self._revalidate_candidate and self._revalidate_candidate[0] == self.gateway:
+                auth_input += f"DATA_KEY=revalidate\nDATA_VAL={self._revalidate_candidate[1]}\n"
+            self._auth_input_data = (auth_input + "DONE\n").encode()
 
             # Reset transient-failure tracking for this auth attempt
             self._all_strategies_transient = True
@@ -1890,6 +2250,85 @@ class PulseSSOPlugin(dbus.service.Object):
         self._kill_auth_dialog()
         return False
 
+    AUTH_TIMING_HISTORY = 20
+
+    def _log_auth_timing(self, stderr: bytes):
+        """
+        Log the per-phase timing record(s) the CEF auth browser emitted
+        ("METRICS {json}" lines relayed on the auth-dialog's stderr), with a
+        rolling median of total login time so regressions across IdP changes
+        or CEF upgrades show up in the journal. The latest record and the
+        auth-dialog's "AUTH-METHOD <name>" line feed the diagnostics. Only the
+        fields this run reports are replaced: a method recorded elsewhere
+        (the Plasma login in _do_connect) stays when no auth-dialog line
+        names one.
+        """
+        for line in stderr.decode(errors="replace").splitlines():
+            if line.startswith("AUTH-METHOD "):
+                self._diag["auth_method"] = line[len("AUTH-METHOD "):].strip()
+                continue
+            if not line.startswith("METRICS "):
+                continue
+            try:
+                record = json.loads(line[len("METRICS "):])
+            except ValueError:
+                logger.debug("Unparseable auth timing record: %s", line)
+                continue
+            total = record.get("total_ms")
+            if isinstance(total, int):
+                self._auth_timings = (self._auth_timings + [total])[-self.AUTH_TIMING_HISTORY:]
+            ordered = sorted(self._auth_timings)
+            median = ordered[len(ordered) // 2] if ordered else None
+            logger.info(
+                "Auth timing: result=%s total=%sms phases=%s (median of last %d: %sms)",
+                record.get("result"), total, json.dumps(record.get("phases_ms", {})),
+                len(ordered), median,
+            )
+            if record.get("renderer_crashes"):
+                logger.warning(
+                    "Auth browser renderer crashed %d time(s); recovered by reloading in place",
+                    record["renderer_crashes"],
+                )
+            self._diag["auth_total_ms"] = total if isinstance(total, int) else -1
+            self._diag["auth_phases"] = json.dumps(record.get("phases_ms", {}))
+        self._emit_diagnostics()
+
+    DIAG_TRAFFIC_INTERVAL = 10
+
+    def _diagnostics_dict(self) -> dbus.Dictionary:
+        d = self._diag
+        return dbus.Dictionary({
+            "auth_total_ms": dbus.Int32(d["auth_total_ms"]),
+            "auth_phases": dbus.String(d["auth_phases"]),
+            "auth_method": dbus.String(d["auth_method"]),
+            "reconnects": dbus.UInt32(d["reconnects"]),
+            "transport": dbus.String(d["transport"]),
+            "mtu": dbus.UInt32(d["mtu"]),
+            "tundev": dbus.String(d["tundev"]),
+            "rx_bytes": dbus.UInt64(d["rx_bytes"]),
+            "tx_bytes": dbus.UInt64(d["tx_bytes"]),
+        }, signature="sv")
+
+    def _emit_diagnostics(self) -> bool:
+        """Push the diagnostics snapshot (main loop; False for GLib.idle_add)."""
+        self.DiagnosticsChanged(self._diagnostics_dict())
+        return False
+
+    def _refresh_tunnel_traffic(self) -> bool:
+        """GLib timer: re-read the tun device byte counters while connected."""
+        tundev = self._diag["tundev"]
+        if self.proc is None or not tundev:
+            self._diag_traffic_id = None
+            return False
+        stats = Path("/sys/class/net") / tundev / "statistics"
+        try:
+            self._diag["rx_bytes"] = int((stats / "rx_bytes").read_text())
+            self._diag["tx_bytes"] = int((stats / "tx_bytes").read_text())
+        except (OSError, ValueError):
+            return True
+        self._emit_diagnostics()
+        return True
+
     def _on_auth_dialog_exit(self, pid: int, status: int):
         """
         Called by GLib when auth-dialog subprocess exits.
@@ -2006,6 +2445,7 @@ class PulseSSOPlugin(dbus.service.Object):
         lines = stdout.decode().strip().split("\n")
         cookie = None
         gwcert = None
+        gwpin = None
         resolve = None
         i = 0
         while i < len(lines):
@@ -2015,6 +2455,10 @@ class PulseSSOPlugin(dbus.service.Object):
             elif lines[i] == "gwcert" and i + 1 < len(lines):
                 gwcert = lines[i + 1]
                 i += 2
+            elif lines[i] == "gwpin" and i + 1 < len(lines):
+                # SPKI pin from the CEF auth browser, usable as --servercert
+                gwpin = lines[i + 1]
+                i += 2
             elif lines[i] == "resolve" and i + 1 < len(lines):
                 # "HOST:IP" — emitted by the browser-auth dialog so we can
                 # tell openconnect to bypass /etc/hosts.
@@ -2045,6 +2489,8 @@ class PulseSSOPlugin(dbus.service.Object):
             logger.info("Disconnect requested, discarding auth result")
             return
 
+        self._log_auth_timing(stderr)
+
         # Success! Update credentials and start openconnect.
         # Log a short fingerprint (length + first/last 4 chars) so we can
         # correlate this cookie against the proxy log without leaking the
@@ -2060,6 +2506,7 @@ class PulseSSOPlugin(dbus.service.Object):
         self.cookie = cookie
         self._cookie_is_fresh = True
         self.servercert = gwcert
+        self.servercert_pin = gwpin
         self.resolve = resolve
 
         self._emit_starting()
@@ -2096,6 +2543,7 @@ class PulseSSOPlugin(dbus.service.Object):
         conn_uuid = connection.get("connection", {}).get("uuid", "")
         if conn_uuid:
             self._active_conn_uuid = conn_uuid
+        self.vpn_data = connection.get("vpn", {}).get("data", {})
 
         # Cancel idle quit timer — we got a Connect call
         if self._idle_quit_timeout_id is not None:
@@ -2112,6 +2560,8 @@ class PulseSSOPlugin(dbus.service.Object):
                 connection.setdefault("vpn", {}).setdefault("secrets", {})["cookie"] = self.cookie
                 if self.servercert:
                     connection["vpn"]["secrets"]["gwcert"] = self.servercert
+                if self.servercert_pin:
+                    connection["vpn"]["secrets"]["gwpin"] = self.servercert_pin
                 if self.resolve:
                     connection["vpn"]["secrets"]["resolve"] = self.resolve
                 self._do_connect(connection)
@@ -2163,6 +2613,7 @@ class PulseSSOPlugin(dbus.service.Object):
         conn_uuid = connection.get("connection", {}).get("uuid", "")
         if conn_uuid:
             self._active_conn_uuid = conn_uuid
+        self.vpn_data = connection.get("vpn", {}).get("data", {})
 
         # Cancel idle quit timer — we got a Connect call
         if self._idle_quit_timeout_id is not None:
@@ -2188,6 +2639,8 @@ class PulseSSOPlugin(dbus.service.Object):
                 connection.setdefault("vpn", {}).setdefault("secrets", {})["cookie"] = self.cookie
                 if self.servercert:
                     connection["vpn"]["secrets"]["gwcert"] = self.servercert
+                if self.servercert_pin:
+                    connection["vpn"]["secrets"]["gwpin"] = self.servercert_pin
                 if self.resolve:
                     connection["vpn"]["secrets"]["resolve"] = self.resolve
                 self._do_connect(connection)
@@ -2233,22 +2686,29 @@ class PulseSSOPlugin(dbus.service.Object):
         """
         Check if secrets are needed.
 
-        Always return '' to prevent NM from asking agents for secrets.
+        Return '' to prevent NM from asking agents for secrets.
         We handle authentication ourselves via direct browser auth in Connect().
         This is necessary because KDE's secrets agent (and others) don't support
         our custom pulse-sso VPN type.
+
+        The exception is PLASMA_INPROCESS_AUTH: then a missing cookie returns
+        "vpn" and plasma-nm's agent runs the login in the plugin's askUser()
+        widget, handing the DSID back as the "cookie" secret.
         """
         settings = convert_dbus_types(settings)
         vpn_secrets = settings.get("vpn", {}).get("secrets", {})
 
         if vpn_secrets.get("cookie"):
             logger.info("NeedSecrets: have cookie, no secrets needed")
+        elif not self.cookie and is_plasma_agent_auth_enabled():
+            logger.info("NeedSecrets: no cookie, asking the Plasma agent")
+            return "vpn"
         else:
             logger.info(
                 "NeedSecrets: no cookie, but returning empty (we handle auth in Connect)"
             )
 
-        # Always return '' - we handle auth ourselves, don't rely on secrets agents
+        # Otherwise return '' - we handle auth ourselves, don't rely on secrets agents
         return ""
 
     @method(dbus_interface=NM_DBUS_INTERFACE, in_signature="", out_signature="")
@@ -2306,6 +2766,7 @@ class PulseSSOPlugin(dbus.service.Object):
                 self.cookie = None
                 self.gateway = None
                 self.servercert = None
+                self.servercert_pin = None
                 self.resolve = None
                 self.pending_connection = None
 
@@ -2411,6 +2872,7 @@ class PulseSSOPlugin(dbus.service.Object):
                 self.cookie = None
                 self.gateway = None
                 self.servercert = None
+                self.servercert_pin = None
                 self.resolve = None
                 self.pending_connection = None
 
@@ -2739,6 +3201,17 @@ class PulseSSOPlugin(dbus.service.Object):
         # Store converted types for internal use
         self.ip4config = convert_dbus_types(config)
 
+        self._diag_connects += 1
+        self._diag["reconnects"] = self._diag_connects - 1
+        self._diag["mtu"] = int(self.ip4config.get("mtu") or 0)
+        self._diag["tundev"] = str(self.config.get("tundev") or "")
+        self._diag["rx_bytes"] = self._diag["tx_bytes"] = 0
+        if self._diag_traffic_id is None:
+            self._diag_traffic_id = GLib.timeout_add_seconds(
+                self.DIAG_TRAFFIC_INTERVAL, self._refresh_tunnel_traffic
+            )
+        self._emit_diagnostics()
+
         # Emit signal to NetworkManager with raw D-Bus types (not converted)
         # The signal expects a{sv} so we pass the config as received
         self.Ip4Config(config)
@@ -2890,6 +3363,16 @@ class PulseSSOPlugin(dbus.service.Object):
         """Emitted during ConnectInteractive when secrets are needed."""
         logger.info("SecretsRequired: %s, secrets=%s", message, secrets)
 
+    @method(dbus_interface=DIAG_DBUS_INTERFACE, in_signature="", out_signature="a{sv}")
+    def GetDiagnostics(self):
+        """Current diagnostics snapshot, for a widget that just opened."""
+        return self._diagnostics_dict()
+
+    @dbus_signal(dbus_interface=DIAG_DBUS_INTERFACE, signature="a{sv}")
+    def DiagnosticsChanged(self, diagnostics: dict[str, Any]):
+        """Emitted whenever an auth run, the tunnel or its counters change."""
+        pass
+
 
 def run(args: Namespace):
     """Main entry point - setup D-Bus and run event loop."""